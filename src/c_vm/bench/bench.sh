@@ -0,0 +1,28 @@
+#!/bin/bash
+# usage: bench.sh <vm binary built with STATS=1> [scripts...]
+# runs every script on both backends: wall time (best of 5) and
+# executed instructions (vm prints them to stderr on exit).
+
+VM=${1:-build/bench/main}
+shift
+SCRIPTS=${@:-$(dirname "$0")/*.lan}
+
+printf "%-12s %-9s %10s %14s\n" script backend "time, s" instructions
+for script in $SCRIPTS; do
+    for backend in stack register; do
+        flag=""
+        [ "$backend" = register ] && flag="--register"
+
+        best=""
+        for run in 1 2 3 4 5; do
+            start=$(date +%s%N)
+            count=$("$VM" $flag "$script" 2>&1 >/dev/null | sed -n 's/^-- instructions: //p')
+            end=$(date +%s%N)
+            elapsed=$(( (end - start) / 1000000 ))
+            if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then best=$elapsed; fi
+        done
+
+        printf "%-12s %-9s %6d.%03d %14s\n" "$(basename "$script")" "$backend" \
+            $((best / 1000)) $((best % 1000)) "$count"
+    done
+done
@@ -0,0 +1,318 @@
+// String hash / intern lookup microbenchmark (make hashbench).
+// Compares hash_string() with the byte-at-a-time FNV loop it replaced:
+// 32-bit collisions, linear probe lengths and lookup speed in a
+// linear-probing table (the Entry layout tools/hashtable.c had), then
+// intern lookups through copy_string() / hashtable_find_string() of an isolate.
+
+#include "../src/cvm.h"
+#include "../src/vm.h"
+#include "../src/object.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+#define KEYS 100000
+#define ROUNDS 20
+
+typedef uint32_t (*HashFn)(const char* key, int length);
+
+typedef struct {
+    char** chars;
+    int* lengths;
+    int count;
+} KeySet;
+
+// hash_string before: FNV-1a loop with a mistyped prime.
+static uint32_t fnv_old(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 167777619;
+    }
+
+    return hash;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+};
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+};
+
+static void keys_add(KeySet* set, const char* chars) {
+    int length = (int)strlen(chars);
+    set->chars[set->count] = (char*)malloc(length + 1);
+    memcpy(set->chars[set->count], chars, length + 1);
+    set->lengths[set->count] = length;
+    set->count++;
+};
+
+static KeySet keys_make(const char* kind) {
+    KeySet set;
+    set.chars = (char**)malloc(sizeof(char*) * KEYS);
+    set.lengths = (int*)malloc(sizeof(int) * KEYS);
+    set.count = 0;
+
+    char buffer[256];
+    for (int i = 0; i < KEYS; i++) {
+        if (strcmp(kind, "ident") == 0) {
+            snprintf(buffer, sizeof(buffer), "name%d", i);
+        } else if (strcmp(kind, "number") == 0) {
+            snprintf(buffer, sizeof(buffer), "%d", i);
+        } else if (strcmp(kind, "word") == 0) {
+            int length = 3 + (int)(rng() % 18);
+            for (int c = 0; c < length; c++) buffer[c] = 'a' + (char)(rng() % 26);
+            buffer[length] = '\0';
+        } else {
+            // long strings differing only at the end
+            snprintf(buffer, sizeof(buffer),
+                     "some fairly long line of script output, record number %08d", i);
+        }
+        keys_add(&set, buffer);
+    }
+
+    return set;
+};
+
+static void keys_free(KeySet* set) {
+    for (int i = 0; i < set->count; i++) free(set->chars[i]);
+    free(set->chars);
+    free(set->lengths);
+};
+
+typedef struct {
+    uint32_t hash;
+    int key;
+} Hashed;
+
+static KeySet* sorted_set;
+
+static int compare_hashed(const void* a, const void* b) {
+    const Hashed* x = (const Hashed*)a;
+    const Hashed* y = (const Hashed*)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return strcmp(sorted_set->chars[x->key], sorted_set->chars[y->key]);
+};
+
+// doubles from 8 while count > 0.75 capacity, as the linear-probing table did.
+static int table_capacity(int count) {
+    int capacity = 8;
+    while (count > capacity * 0.75) capacity *= 2;
+    return capacity;
+};
+
+// distinct keys with equal 32-bit hashes, and linear probe lengths.
+static void distribution(HashFn hash, KeySet* set, int* collisions, double* probes, int* max_probe) {
+    Hashed* hashed = (Hashed*)malloc(sizeof(Hashed) * set->count);
+    for (int i = 0; i < set->count; i++) {
+        hashed[i].hash = hash(set->chars[i], set->lengths[i]);
+        hashed[i].key = i;
+    }
+
+    int capacity = table_capacity(set->count);
+    uint8_t* used = (uint8_t*)calloc(capacity, 1);
+
+    long total = 0;
+    *max_probe = 0;
+    for (int i = 0; i < set->count; i++) {
+        uint32_t index = hashed[i].hash & (capacity - 1);
+        int probe = 1;
+        while (used[index]) {
+            index = (index + 1) & (capacity - 1);
+            probe++;
+        }
+        used[index] = 1;
+        total += probe;
+        if (probe > *max_probe) *max_probe = probe;
+    }
+    *probes = (double)total / set->count;
+
+    sorted_set = set;
+    qsort(hashed, set->count, sizeof(Hashed), compare_hashed);
+    *collisions = 0;
+    for (int i = 1; i < set->count; i++) {
+        if (hashed[i].hash == hashed[i - 1].hash &&
+            strcmp(set->chars[hashed[i].key], set->chars[hashed[i - 1].key]) != 0) {
+            (*collisions)++;
+        }
+    }
+
+    free(used);
+    free(hashed);
+};
+
+typedef struct {
+    int* slots; // key index, -1 empty
+    uint32_t* hashes;
+    int capacity;
+    bool legacy; // old find_string: `%` indexing, length compared first
+} Table;
+
+static Table table_build(HashFn hash, KeySet* set, bool legacy) {
+    Table t;
+    t.capacity = table_capacity(set->count);
+    t.slots = (int*)malloc(sizeof(int) * t.capacity);
+    t.hashes = (uint32_t*)malloc(sizeof(uint32_t) * t.capacity);
+    t.legacy = legacy;
+    for (int i = 0; i < t.capacity; i++) t.slots[i] = -1;
+
+    for (int i = 0; i < set->count; i++) {
+        uint32_t h = hash(set->chars[i], set->lengths[i]);
+        uint32_t index = h & (t.capacity - 1);
+        while (t.slots[index] != -1) index = (index + 1) & (t.capacity - 1);
+        t.slots[index] = i;
+        t.hashes[index] = h;
+    }
+
+    return t;
+};
+
+static int table_find(Table* t, KeySet* set, HashFn hash, const char* chars, int length) {
+    uint32_t h = hash(chars, length);
+    if (t->legacy) {
+        uint32_t index = h % t->capacity;
+        for (;;) {
+            int key = t->slots[index];
+            if (key == -1) return -1;
+            if (set->lengths[key] == length && t->hashes[index] == h &&
+                memcmp(set->chars[key], chars, length) == 0) {
+                return key;
+            }
+            index = (index + 1) % t->capacity;
+        }
+    }
+
+    uint32_t mask = (uint32_t)t->capacity - 1;
+    for (uint32_t index = h & mask;; index = (index + 1) & mask) {
+        int key = t->slots[index];
+        if (key == -1) return -1;
+        if (t->hashes[index] == h && set->lengths[key] == length &&
+            memcmp(set->chars[key], chars, length) == 0) {
+            return key;
+        }
+    }
+};
+
+// ns per lookup of every key, then of every key with its last char changed.
+static void table_speed(HashFn hash, KeySet* set, bool legacy, double* hit, double* miss) {
+    Table t = table_build(hash, set, legacy);
+    volatile int sink = 0;
+
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < set->count; i++) {
+            sink += table_find(&t, set, hash, set->chars[i], set->lengths[i]);
+        }
+    }
+    *hit = (now() - start) * 1e9 / ((double)ROUNDS * set->count);
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < set->count; i++) {
+            char* chars = set->chars[i];
+            int length = set->lengths[i];
+            chars[length - 1] ^= 0x40;
+            sink += table_find(&t, set, hash, chars, length);
+            chars[length - 1] ^= 0x40;
+        }
+    }
+    *miss = (now() - start) * 1e9 / ((double)ROUNDS * set->count);
+
+    free(t.slots);
+    free(t.hashes);
+};
+
+static double hash_speed(HashFn hash, KeySet* set) {
+    volatile uint32_t sink = 0;
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < set->count; i++) sink ^= hash(set->chars[i], set->lengths[i]);
+    }
+    return (now() - start) * 1e9 / ((double)ROUNDS * set->count);
+};
+
+// ns per intern lookup: hits (copy_string finds the key) and misses.
+static void intern_speed(KeySet* set, double* hit, double* miss) {
+    VM* isolate = cvm_new(NULL);
+    vm_current = isolate;
+
+    // interned strings are garbage without roots, keep them in a global.
+    for (int i = 0; i < set->count; i++) {
+        ObjString* key = copy_string(set->chars[i], set->lengths[i]);
+        vm_stack_push(OBJ_VAL(key));
+        hashtable_set(&vm.globals, key, NULL_VAL);
+        vm_stack_pop();
+    }
+
+    volatile uintptr_t sink = 0;
+    double start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < set->count; i++) {
+            sink ^= (uintptr_t)copy_string(set->chars[i], set->lengths[i]);
+        }
+    }
+    *hit = (now() - start) * 1e9 / ((double)ROUNDS * set->count);
+
+    start = now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < set->count; i++) {
+            // same length, last char changed: the hash has to reject it.
+            char* chars = set->chars[i];
+            int length = set->lengths[i];
+            chars[length - 1] ^= 0x40;
+            uint32_t hash = hash_string(chars, length);
+            sink ^= (uintptr_t)hashtable_find_string(&vm.strings, chars, length, hash);
+            chars[length - 1] ^= 0x40;
+        }
+    }
+    *miss = (now() - start) * 1e9 / ((double)ROUNDS * set->count);
+
+    vm_current = NULL;
+    cvm_free(isolate);
+};
+
+int main() {
+    const char* kinds[] = {"ident", "number", "word", "long"};
+    HashFn fns[] = {fnv_old, hash_string};
+    const char* names[] = {"fnv-old", "current"};
+
+    printf("%d keys per set, linear probing, power-of-two table at <= 0.75 load\n", KEYS);
+    printf("fnv-old lookups: `%%` indexing, length compared first\n\n");
+    printf("%-7s %-8s %10s %7s %5s %8s %8s %8s\n",
+           "keys", "hash", "collisions", "probes", "max", "ns/hash", "ns/hit", "ns/miss");
+    for (int k = 0; k < 4; k++) {
+        KeySet set = keys_make(kinds[k]);
+        for (int f = 0; f < 2; f++) {
+            int collisions, max_probe;
+            double probes, hit, miss;
+            distribution(fns[f], &set, &collisions, &probes, &max_probe);
+            double ns = hash_speed(fns[f], &set);
+            table_speed(fns[f], &set, f == 0, &hit, &miss);
+            printf("%-7s %-8s %10d %7.2f %5d %8.2f %8.2f %8.2f\n", kinds[k], names[f],
+                   collisions, probes, max_probe, ns, hit, miss);
+        }
+        keys_free(&set);
+    }
+
+    printf("\nvm intern lookups (copy_string, hashtable_find_string)\n");
+    printf("%-7s %8s %8s\n", "keys", "ns/hit", "ns/miss");
+    for (int k = 0; k < 4; k++) {
+        KeySet set = keys_make(kinds[k]);
+        double hit, miss;
+        intern_speed(&set, &hit, &miss);
+        printf("%-7s %8.2f %8.2f\n", kinds[k], hit, miss);
+        keys_free(&set);
+    }
+
+    return 0;
+};
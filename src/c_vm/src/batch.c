@@ -0,0 +1,285 @@
+#include "batch.h"
+#include "tools/mapped_file.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "dirent.h"
+#include "pthread.h"
+#include "time.h"
+#include "unistd.h"
+#include "sys/stat.h"
+
+typedef enum {
+    JOB_SKIPPED, // no isolate could take it
+    JOB_OK,
+    JOB_COMPILE_ERROR,
+    JOB_RUNTIME_ERROR,
+    JOB_IO_ERROR,
+} JobStatus;
+
+static const char* status_names[] = {
+    [JOB_SKIPPED] = "skipped",
+    [JOB_OK] = "ok",
+    [JOB_COMPILE_ERROR] = "compile",
+    [JOB_RUNTIME_ERROR] = "runtime",
+    [JOB_IO_ERROR] = "io",
+};
+
+static const int status_codes[] = {
+    [JOB_SKIPPED] = 74,
+    [JOB_OK] = 0,
+    [JOB_COMPILE_ERROR] = 65,
+    [JOB_RUNTIME_ERROR] = 70,
+    [JOB_IO_ERROR] = 74,
+};
+
+typedef struct {
+    char* path;
+    JobStatus status;
+    uint64_t elapsed_ns;
+} Job;
+
+// job indices [front, back) of one worker. Blocks only shrink or move
+// whole to an empty deque, so a range is enough.
+typedef struct {
+    pthread_mutex_t lock;
+    int front;
+    int back;
+} Deque;
+
+typedef struct {
+    Job* jobs;
+    int count;
+    int capacity;
+    Deque* deques;
+    int workers;
+    const CvmOptions* options;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int index;
+    pthread_t thread;
+} Worker;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+};
+
+// ------------ job list
+
+static void add_job(Batch* batch, char* path) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity < 64 ? 64 : batch->capacity * 2;
+        batch->jobs = (Job*)realloc(batch->jobs, sizeof(Job) * batch->capacity);
+        if (batch->jobs == NULL) exit(1);
+    }
+
+    Job* job = &batch->jobs[batch->count++];
+    job->path = path;
+    job->status = JOB_SKIPPED;
+    job->elapsed_ns = 0;
+};
+
+static int compare_jobs(const void* a, const void* b) {
+    return strcmp(((const Job*)a)->path, ((const Job*)b)->path);
+};
+
+static bool list_directory(Batch* batch, const char* dir_path) {
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL) return false;
+
+    size_t dir_length = strlen(dir_path);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".lan") != 0) continue;
+
+        char* path = (char*)malloc(dir_length + length + 2);
+        if (path == NULL) exit(1);
+        sprintf(path, "%s/%s", dir_path, entry->d_name);
+        add_job(batch, path);
+    }
+
+    closedir(dir);
+    qsort(batch->jobs, batch->count, sizeof(Job), compare_jobs);
+    return true;
+};
+
+static bool list_manifest(Batch* batch, const char* manifest_path) {
+    FILE* f = fopen(manifest_path, "r");
+    if (f == NULL) return false;
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, f)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' ||
+                              line[length - 1] == ' ')) {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#') continue;
+
+        char* path = strdup(line);
+        if (path == NULL) exit(1);
+        add_job(batch, path);
+    }
+
+    free(line);
+    fclose(f);
+    return true;
+};
+
+// ------------ work stealing
+
+static bool take(Deque* deque, int* job) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->front < deque->back;
+    if (found) *job = deque->front++;
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+};
+
+// move back half of some other worker's jobs to own (empty) deque.
+static bool steal(Batch* batch, int self) {
+    for (int i = 1; i < batch->workers; i++) {
+        Deque* victim = &batch->deques[(self + i) % batch->workers];
+        pthread_mutex_lock(&victim->lock);
+        int count = (victim->back - victim->front + 1) / 2;
+        int from = victim->back - count;
+        victim->back = from;
+        pthread_mutex_unlock(&victim->lock);
+        if (count == 0) continue;
+
+        Deque* own = &batch->deques[self];
+        pthread_mutex_lock(&own->lock);
+        own->front = from;
+        own->back = from + count;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+
+    return false;
+};
+
+static void run_job(VM* isolate, Job* job) {
+    uint64_t start = now_ns();
+
+    MappedFile source;
+    if (!mapped_file_open(&source, job->path)) {
+        job->status = JOB_IO_ERROR;
+    } else {
+        INTERPRET_RESULT result = cvm_run(isolate, source.chars, job->path);
+        job->status = result == INTERPRET_OK ? JOB_OK
+            : result == INTERPRET_COMPILE_ERROR ? JOB_COMPILE_ERROR
+            : JOB_RUNTIME_ERROR;
+        cvm_reset(isolate);
+        mapped_file_close(&source);
+    }
+
+    job->elapsed_ns = now_ns() - start;
+};
+
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Batch* batch = worker->batch;
+
+    // one isolate per worker for all of its jobs.
+    VM* isolate = cvm_new(batch->options);
+    if (isolate == NULL) return NULL;
+
+    Deque* own = &batch->deques[worker->index];
+    int job;
+    while (take(own, &job) || (steal(batch, worker->index) && take(own, &job))) {
+        run_job(isolate, &batch->jobs[job]);
+    }
+
+    cvm_free(isolate);
+    return NULL;
+};
+
+// ------------ report
+
+static void report(Batch* batch, uint64_t wall_ns) {
+    int counts[JOB_IO_ERROR + 1] = {0};
+    uint64_t total_ns = 0;
+    for (int i = 0; i < batch->count; i++) {
+        Job* job = &batch->jobs[i];
+        counts[job->status]++;
+        total_ns += job->elapsed_ns;
+        fprintf(stderr, "%10.3f %-8s %s\n",
+                job->elapsed_ns / 1e6, status_names[job->status], job->path);
+    }
+
+    double wall = wall_ns / 1e9;
+    fprintf(stderr, "-- batch: %d scripts, %d workers, %.3f s wall, %.3f s in scripts, %.1f scripts/s\n",
+            batch->count, batch->workers, wall, total_ns / 1e9,
+            wall > 0 ? batch->count / wall : 0.0);
+    fprintf(stderr, "-- ok %d, compile errors %d, runtime errors %d, io errors %d, skipped %d\n",
+            counts[JOB_OK], counts[JOB_COMPILE_ERROR], counts[JOB_RUNTIME_ERROR],
+            counts[JOB_IO_ERROR], counts[JOB_SKIPPED]);
+};
+
+int batch_default_workers() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+};
+
+int batch_run(const char* list_path, const CvmOptions* options, int workers) {
+    Batch batch = {.jobs = NULL, .count = 0, .capacity = 0, .options = options};
+
+    struct stat info;
+    bool listed = stat(list_path, &info) == 0 && S_ISDIR(info.st_mode)
+        ? list_directory(&batch, list_path)
+        : list_manifest(&batch, list_path);
+    if (!listed) {
+        fprintf(stderr, "--batch: can't read '%s'.\n", list_path);
+        return 74;
+    }
+
+    batch.workers = workers < batch.count ? workers : batch.count;
+    if (batch.workers < 1) batch.workers = 1;
+    batch.deques = (Deque*)malloc(sizeof(Deque) * batch.workers);
+    Worker* pool = (Worker*)malloc(sizeof(Worker) * batch.workers);
+    if (batch.deques == NULL || pool == NULL) exit(1);
+
+    // contiguous blocks, first count % workers deques get one more.
+    int from = 0;
+    for (int i = 0; i < batch.workers; i++) {
+        int size = batch.count / batch.workers + (i < batch.count % batch.workers);
+        pthread_mutex_init(&batch.deques[i].lock, NULL);
+        batch.deques[i].front = from;
+        batch.deques[i].back = from + size;
+        from += size;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < batch.workers; i++) {
+        pool[i].batch = &batch;
+        pool[i].index = i;
+        if (pthread_create(&pool[i].thread, NULL, worker_main, &pool[i]) != 0) {
+            fprintf(stderr, "--batch: can't start worker thread.\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < batch.workers; i++) pthread_join(pool[i].thread, NULL);
+    uint64_t wall_ns = now_ns() - start;
+
+    fflush(stdout);
+    report(&batch, wall_ns);
+
+    int code = 0;
+    for (int i = 0; i < batch.count; i++) {
+        int job_code = status_codes[batch.jobs[i].status];
+        if (job_code > code) code = job_code;
+        free(batch.jobs[i].path);
+    }
+
+    for (int i = 0; i < batch.workers; i++) pthread_mutex_destroy(&batch.deques[i].lock);
+    free(batch.deques);
+    free(pool);
+    free(batch.jobs);
+    return code;
+};
@@ -0,0 +1,33 @@
+#ifndef CVM_BATCH_H
+#define CVM_BATCH_H
+
+#include "common.h"
+#include "cvm.h"
+
+/*
+    Batch runner (main: --batch <dir|manifest> [--jobs N]).
+
+    Scripts are the *.lan files of a directory (sorted by name) or the
+    paths listed in a manifest, one per line; blank lines and lines
+    starting with '#' are skipped.
+
+    A fixed pool of worker threads runs them, each worker with its own
+    isolate (cvm.h) reused between scripts: cvm_reset drops globals, the
+    heap stays. Jobs are dealt to per-worker deques in contiguous blocks,
+    a worker takes from the front of its own deque and when it is empty
+    steals the back half of another one.
+
+    Script output goes to stdout, print lines of parallel scripts
+    interleave. Report goes to stderr, one line per script in list order
+        <ms> <status> <path>
+    then totals and throughput.
+*/
+
+// default worker count: online cpus.
+int batch_default_workers();
+
+// run all scripts of `list_path`, exit code: 0 if all succeeded, else the
+// highest of main's codes (65 compile, 70 runtime, 74 io error).
+int batch_run(const char* list_path, const CvmOptions* options, int workers);
+
+#endif
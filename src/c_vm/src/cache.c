@@ -0,0 +1,423 @@
+#include "cache.h"
+#include "vm.h"
+#include "gc.h"
+#include "regvm.h"
+#include "stdlib.h"
+#include "string.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+#define CACHE_MAGIC "LANC"
+
+// code was run through optimizer.c.
+#define CACHE_OPTIMIZED 0x1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t source_length;
+    uint64_t source_hash;
+    uint64_t payload_hash;
+    uint64_t payload_length;
+} CacheHeader;
+
+typedef enum {
+    CONST_NULL,
+    CONST_FALSE,
+    CONST_TRUE,
+    CONST_NUMBER,
+    CONST_STRING,
+    CONST_FUNCTION,
+} CacheConst;
+
+// FNV-1a, 64 bit.
+static uint64_t hash_bytes(const uint8_t* bytes, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+};
+
+// what compiler emits in this run (see end_compiler).
+static uint32_t cache_flags() {
+    uint32_t flags = 0;
+    #ifdef COMPILER_OPTIMIZE
+    // register backend translates code before optimizer.
+    if (vm.backend == BACKEND_STACK) flags |= CACHE_OPTIMIZED;
+    #endif
+    return flags;
+};
+
+static char* cache_path(const char* path, const char* suffix) {
+    size_t length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    char* result = (char*)malloc(length + suffix_length + 1);
+    if (result == NULL) return NULL;
+
+    memcpy(result, path, length);
+    memcpy(result + length, suffix, suffix_length + 1);
+    return result;
+};
+
+// ----------------- WRITE
+// plain malloc buffer: no vm allocations, gc can't run while storing.
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} Writer;
+
+static void write_bytes(Writer* w, const void* bytes, size_t length) {
+    if (w->failed) return;
+
+    if (w->count + length > w->capacity) {
+        size_t capacity = w->capacity < 256 ? 256 : w->capacity;
+        while (capacity < w->count + length) capacity *= 2;
+
+        uint8_t* grown = (uint8_t*)realloc(w->bytes, capacity);
+        if (grown == NULL) {
+            w->failed = true;
+            return;
+        }
+
+        w->bytes = grown;
+        w->capacity = capacity;
+    }
+
+    memcpy(w->bytes + w->count, bytes, length);
+    w->count += length;
+};
+
+static void write_u8(Writer* w, uint8_t value) {
+    write_bytes(w, &value, sizeof(value));
+};
+
+static void write_u32(Writer* w, uint32_t value) {
+    write_bytes(w, &value, sizeof(value));
+};
+
+static void write_string(Writer* w, ObjString* string) {
+    write_u32(w, (uint32_t)string->length);
+    write_bytes(w, string->chars, string->length);
+};
+
+static void write_function(Writer* w, ObjFunction* function) {
+    write_u32(w, (uint32_t)function->arity);
+    write_u32(w, (uint32_t)function->upvalue_count);
+    write_u8(w, function->name != NULL);
+    if (function->name != NULL) write_string(w, function->name);
+
+    Chunk* chunk = &function->chunk;
+    write_u32(w, (uint32_t)chunk->count);
+    write_bytes(w, chunk->code, chunk->count);
+    write_bytes(w, chunk->lines, sizeof(int) * chunk->count);
+
+    write_u32(w, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_NULL(value)) {
+            write_u8(w, CONST_NULL);
+        } else if (IS_BOOL(value)) {
+            write_u8(w, AS_BOOL(value) ? CONST_TRUE : CONST_FALSE);
+        } else if (IS_NUMBER(value)) {
+            double number = AS_NUMBER(value);
+            write_u8(w, CONST_NUMBER);
+            write_bytes(w, &number, sizeof(number));
+        } else if (IS_STRING(value)) {
+            write_u8(w, CONST_STRING);
+            write_string(w, AS_STRING(value));
+        } else if (IS_FUNCTION(value)) {
+            write_u8(w, CONST_FUNCTION);
+            write_function(w, AS_FUNCTION(value));
+        } else {
+            w->failed = true;
+        }
+    }
+};
+
+bool cache_store(const char* path, const char* source, ObjFunction* script) {
+    Writer w = {NULL, 0, 0, false};
+
+    // code operands are slots of this vm, names make them portable.
+    write_u32(&w, (uint32_t)vm.global_names.count);
+    for (int i = 0; i < vm.global_names.count; i++) {
+        write_string(&w, AS_STRING(vm.global_names.values[i]));
+    }
+    write_function(&w, script);
+
+    if (w.failed) {
+        free(w.bytes);
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.flags = cache_flags();
+    header.source_length = (uint32_t)strlen(source);
+    header.source_hash = hash_bytes((const uint8_t*)source, header.source_length);
+    header.payload_hash = hash_bytes(w.bytes, w.count);
+    header.payload_length = w.count;
+
+    // write aside and rename: readers never see a half written file.
+    // temp name is unique, concurrent writers (batch jobs, processes)
+    // don't truncate each other's file, the last rename wins.
+    char* file_path = cache_path(path, "c");
+    char* tmp_path = cache_path(path, "c.XXXXXX");
+    bool ok = false;
+    int fd = file_path && tmp_path ? mkstemp(tmp_path) : -1;
+    FILE* f = NULL;
+    if (fd >= 0) {
+        // mkstemp makes it 0600, cache is as readable as a plain file.
+        fchmod(fd, 0644);
+        f = fdopen(fd, "wb");
+        if (f == NULL) {
+            close(fd);
+            remove(tmp_path);
+        }
+    }
+    if (f != NULL) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(w.bytes, 1, w.count, f) == w.count;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp_path, file_path) == 0;
+        if (!ok) remove(tmp_path);
+    }
+
+    free(file_path);
+    free(tmp_path);
+    free(w.bytes);
+    return ok;
+};
+
+// ----------------- READ
+
+typedef struct {
+    const uint8_t* at;
+    const uint8_t* end;
+    int* slots; // file global index -> vm slot
+    int slots_count;
+    bool failed;
+} Reader;
+
+static const uint8_t* read_bytes(Reader* r, size_t length) {
+    if (r->failed || (size_t)(r->end - r->at) < length) {
+        r->failed = true;
+        return NULL;
+    }
+
+    const uint8_t* bytes = r->at;
+    r->at += length;
+    return bytes;
+};
+
+static uint8_t read_u8(Reader* r) {
+    const uint8_t* bytes = read_bytes(r, 1);
+    return bytes != NULL ? *bytes : 0;
+};
+
+static uint32_t read_u32(Reader* r) {
+    uint32_t value = 0;
+    const uint8_t* bytes = read_bytes(r, sizeof(value));
+    if (bytes != NULL) memcpy(&value, bytes, sizeof(value));
+    return value;
+};
+
+static ObjString* read_string(Reader* r) {
+    uint32_t length = read_u32(r);
+    const uint8_t* chars = read_bytes(r, length);
+    if (chars == NULL) return NULL;
+
+    return copy_string((const char*)chars, (int)length);
+};
+
+static void read_code(Reader* r, Chunk* chunk) {
+    uint32_t count = read_u32(r);
+    const uint8_t* code = read_bytes(r, count);
+    const uint8_t* lines = read_bytes(r, sizeof(int) * (size_t)count);
+    if (r->failed) return;
+
+    if ((int)count > chunk->capacity) {
+        chunk->code = MEM_GROW(uint8_t, chunk->code, chunk->capacity, count);
+        chunk->lines = MEM_GROW(int, chunk->lines, chunk->capacity, count);
+        chunk->capacity = count;
+    }
+
+    memcpy(chunk->code, code, count);
+    memcpy(chunk->lines, lines, sizeof(int) * count);
+    chunk->count = count;
+};
+
+// global operands: file slot -> this vm's slot. Needs constants loaded,
+// closure length depends on function's upvalue count.
+static void remap_globals(Reader* r, Chunk* chunk) {
+    int offset = 0;
+    while (offset < chunk->count) {
+        uint8_t op = chunk->code[offset];
+        if (op == OP_CLOSURE) {
+            if (offset + 1 >= chunk->count ||
+                chunk->code[offset + 1] >= chunk->constants.count ||
+                !IS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]])) {
+                r->failed = true;
+                return;
+            }
+        }
+
+        int length = chunk_instruction_length(chunk, offset);
+        if (offset + length > chunk->count) {
+            r->failed = true;
+            return;
+        }
+
+        if (op == OP_DEFINE_GLOBAL || op == OP_SET_GLOBAL || op == OP_GET_GLOBAL) {
+            int index = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+            if (index >= r->slots_count) {
+                r->failed = true;
+                return;
+            }
+
+            int slot = r->slots[index];
+            chunk->code[offset + 1] = (slot >> 8) & 0xff;
+            chunk->code[offset + 2] = slot & 0xff;
+        }
+
+        offset += length;
+    }
+};
+
+static ObjFunction* read_function(Reader* r) {
+    // on vm stack while its strings and nested functions are allocated.
+    ObjFunction* function = new_function();
+    vm_stack_push(OBJ_VAL(function));
+
+    function->arity = (int)read_u32(r);
+    function->upvalue_count = (int)read_u32(r);
+    if (read_u8(r)) {
+        function->name = read_string(r);
+        if (function->name != NULL) {
+            GC_WRITE_BARRIER(function, OBJ_VAL(function->name));
+        }
+    }
+
+    read_code(r, &function->chunk);
+
+    uint32_t constants_count = read_u32(r);
+    for (uint32_t i = 0; i < constants_count && !r->failed; i++) {
+        Value value = NULL_VAL;
+        switch (read_u8(r)) {
+        case CONST_NULL: break;
+        case CONST_FALSE: value = BOOL_VAl(false); break;
+        case CONST_TRUE: value = BOOL_VAl(true); break;
+        case CONST_NUMBER: {
+            double number;
+            const uint8_t* bytes = read_bytes(r, sizeof(number));
+            if (bytes == NULL) break;
+            memcpy(&number, bytes, sizeof(number));
+            value = NUMBER_VAL(number);
+            break;
+        }
+        case CONST_STRING: {
+            ObjString* string = read_string(r);
+            if (string != NULL) value = OBJ_VAL(string);
+            break;
+        }
+        case CONST_FUNCTION: {
+            ObjFunction* nested = read_function(r);
+            if (nested != NULL) value = OBJ_VAL(nested);
+            break;
+        }
+        default:
+            r->failed = true;
+            break;
+        }
+
+        if (r->failed) break;
+        chunk_add_constant(&function->chunk, value);
+        GC_WRITE_BARRIER(function, value);
+    }
+
+    if (!r->failed) remap_globals(r, &function->chunk);
+    if (!r->failed) {
+        function->max_slots = chunk_max_stack(&function->chunk, 1 + function->arity);
+        if (function->max_slots < 0) r->failed = true;
+    }
+    if (!r->failed && vm.backend == BACKEND_REGISTER && !reg_compile(function)) {
+        r->failed = true;
+    }
+
+    vm_stack_pop();
+    return r->failed ? NULL : function;
+};
+
+static ObjFunction* read_payload(const uint8_t* payload, size_t length) {
+    Reader r = {payload, payload + length, NULL, 0, false};
+
+    uint32_t names_count = read_u32(&r);
+    if (names_count > UINT16_MAX + 1 ||
+        (size_t)(r.end - r.at) < sizeof(uint32_t) * (size_t)names_count) {
+        return NULL;
+    }
+
+    r.slots = (int*)malloc(sizeof(int) * (names_count + 1));
+    if (r.slots == NULL) return NULL;
+
+    for (uint32_t i = 0; i < names_count && !r.failed; i++) {
+        ObjString* name = read_string(&r);
+        if (name == NULL) break;
+
+        int slot = vm_global_slot(name);
+        if (slot > UINT16_MAX) r.failed = true;
+        r.slots[r.slots_count++] = slot;
+    }
+
+    ObjFunction* script = r.failed ? NULL : read_function(&r);
+    free(r.slots);
+    return script;
+};
+
+ObjFunction* cache_load(const char* path, const char* source) {
+    char* file_path = cache_path(path, "c");
+    if (file_path == NULL) return NULL;
+
+    int fd = open(file_path, O_RDONLY);
+    free(file_path);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return NULL;
+
+    const CacheHeader* header = (const CacheHeader*)mapped;
+    const uint8_t* payload = (const uint8_t*)mapped + sizeof(CacheHeader);
+    size_t payload_length = size - sizeof(CacheHeader);
+    size_t source_length = strlen(source);
+
+    ObjFunction* script = NULL;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == CACHE_VERSION &&
+        header->flags == cache_flags() &&
+        header->source_length == source_length &&
+        header->payload_length == payload_length &&
+        header->source_hash == hash_bytes((const uint8_t*)source, source_length) &&
+        header->payload_hash == hash_bytes(payload, payload_length)) {
+        script = read_payload(payload, payload_length);
+    }
+
+    munmap(mapped, size);
+    return script;
+};
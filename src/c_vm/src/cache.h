@@ -0,0 +1,32 @@
+#ifndef CVM_CACHE_H
+#define CVM_CACHE_H
+
+#include "common.h"
+#include "object.h"
+
+/*
+    Bytecode cache: compiled script kept next to its source
+    (`script.lan` -> `script.lanc`), so later runs skip scanner and compiler.
+
+    File: header, then payload:
+        globals  - names of vm global slots used by the code,
+                   code operands are remapped to this vm's slots on load.
+        function - arity, upvalue count, name, code, lines, constants;
+                   nested functions are stored inline as constants.
+
+    Cache is valid only for the same source (length + FNV-1a hash) and
+    the same code shape (CACHE_VERSION, optimized or not). Payload has its
+    own hash, a damaged file is just a cache miss. File is mmap-ed and
+    chunks are copied straight out of the mapping.
+    Numbers and lines are stored in host byte order.
+*/
+
+#define CACHE_VERSION 2
+
+// script function from `path`-s cache, NULL on miss.
+ObjFunction* cache_load(const char* path, const char* source);
+
+// write compiled script for `path`, false if file can't be written.
+bool cache_store(const char* path, const char* source, ObjFunction* script);
+
+#endif
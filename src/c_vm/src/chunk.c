@@ -1,4 +1,5 @@
 #include "chunk.h"
+#include "vm.h"
 
 Chunk* chunk_alloc() {
     return (Chunk*)MEM_MALLOC(sizeof(Chunk));
@@ -28,7 +29,10 @@ void chunk_write(Chunk* t, uint8_t byte, int line) {
 };
 
 int chunk_add_constant(Chunk *t, Value constant) {
+    // constant may be unreachable yet, keep it while array grows.
+    vm_stack_push(constant);
     valueArray_write(&t->constants, constant);
+    vm_stack_pop();
     return t->constants.count-1;
 };
 
@@ -40,3 +44,171 @@ void chunk_destroy(Chunk* t) {
     t->code = NULL;
     valueArray_destroy(&t->constants);
 };
+
+int chunk_instruction_length(Chunk* t, int offset) {
+    switch (t->code[offset])
+    {
+    case OP_CONST:
+    case OP_SET_LOCAL:
+    case OP_GET_LOCAL:
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CALL_CLOSURE:
+    case OP_CALL_FUNCTION:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_SET_LOCAL_POP:
+        return 2;
+
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_ADD_LOCAL_CONST:
+        return 3;
+
+    case OP_LESS_LOCALS_JUMP_IF_FALSE:
+    case OP_LESS_LOCAL_CONST_JUMP_IF_FALSE:
+        return 5;
+
+    case OP_CLOSURE: {
+        // each upvalue is a pair (is_local, index).
+        ObjFunction* func = AS_FUNCTION(t->constants.values[t->code[offset + 1]]);
+        return 2 + func->upvalue_count * 2;
+    }
+
+    default:
+        return 1;
+    }
+};
+
+// jump offset: the last two bytes of the instruction.
+static uint16_t chunk_jump_operand(Chunk* t, int offset, int length) {
+    return (uint16_t)((t->code[offset + length - 2] << 8) | t->code[offset + length - 1]);
+};
+
+// destination of jump at offset (superinstructions too), -1 for other opcodes.
+static int chunk_jump_target(Chunk* t, int offset) {
+    int length = chunk_instruction_length(t, offset);
+
+    switch (t->code[offset])
+    {
+    case OP_LOOP:
+        return offset + length - chunk_jump_operand(t, offset, length);
+
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_LESS_LOCALS_JUMP_IF_FALSE:
+    case OP_LESS_LOCAL_CONST_JUMP_IF_FALSE:
+        return offset + length + chunk_jump_operand(t, offset, length);
+
+    default:
+        return -1;
+    }
+};
+
+int chunk_stack_effect(Chunk* t, int offset) {
+    switch (t->code[offset])
+    {
+    case OP_CONST:
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_DUP:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_ADD_LOCAL_CONST:
+        return 1;
+
+    case OP_ADD:
+    case OP_ADD_NUM:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_PRINT:
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_CLOSE_UPVALUE:
+    case OP_RET:
+    case OP_SET_LOCAL_POP:
+        return -1;
+
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CALL_CLOSURE:
+    case OP_CALL_FUNCTION:
+        return -t->code[offset + 1];
+
+    default:
+        return 0;
+    }
+};
+
+int chunk_stack_depths(Chunk* t, int entry_depth, int* depth_at) {
+    for (int i = 0; i < t->count; i++) depth_at[i] = -1;
+    if (t->count == 0) return entry_depth;
+
+    int* work = ALLOCATE(int, t->count);
+    int work_count = 0;
+    int max_depth = entry_depth;
+    bool consistent = true;
+
+    depth_at[0] = entry_depth;
+    work[work_count++] = 0;
+
+    while (work_count > 0 && consistent) {
+        int offset = work[--work_count];
+        int depth = depth_at[offset] + chunk_stack_effect(t, offset);
+        if (depth > max_depth) max_depth = depth;
+
+        uint8_t op = t->code[offset];
+        int next[2];
+        int next_count = 0;
+        int target = chunk_jump_target(t, offset);
+        if (target >= 0) next[next_count++] = target;
+        if (op != OP_JUMP && op != OP_LOOP && op != OP_RET) {
+            next[next_count++] = offset + chunk_instruction_length(t, offset);
+        }
+
+        for (int i = 0; i < next_count; i++) {
+            int to = next[i];
+            if (to >= t->count) continue;
+
+            if (depth_at[to] < 0) {
+                depth_at[to] = depth;
+                work[work_count++] = to;
+            } else if (depth_at[to] != depth) {
+                consistent = false;
+            }
+        }
+    }
+
+    MEM_FREE(int, work, t->count);
+    return consistent ? max_depth : -1;
+};
+
+int chunk_max_stack(Chunk* t, int entry_depth) {
+    int* depth_at = ALLOCATE(int, t->count + 1);
+    int max_depth = chunk_stack_depths(t, entry_depth, depth_at);
+    MEM_FREE(int, depth_at, t->count + 1);
+    return max_depth;
+};
+
+uint8_t chunk_generic_op(uint8_t op) {
+    switch (op)
+    {
+    case OP_ADD_NUM: return OP_ADD;
+    case OP_CALL_CLOSURE: return OP_CALL;
+    case OP_CALL_FUNCTION: return OP_CALL;
+    default: return op;
+    }
+};
@@ -36,17 +36,31 @@ typedef enum {
     OP_GET_LOCAL,
     // jumps
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
     OP_JUMP,
     OP_LOOP,
     // duplicate
     OP_DUP,
     // functions
     OP_CALL,
+    OP_TAIL_CALL, // `return f(...)`: reuses caller's frame, OP_RET follows
     // closures
     OP_CLOSURE,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
     OP_CLOSE_UPVALUE,
+    // superinstructions, made by optimizer.c
+    OP_ADD_LOCAL_CONST, // GET_LOCAL, CONST, ADD
+    OP_SET_LOCAL_POP, // SET_LOCAL, POP
+    OP_LESS_LOCALS_JUMP_IF_FALSE, // GET_LOCAL, GET_LOCAL, LESS, JUMP_IF_FALSE, POP
+    OP_LESS_LOCAL_CONST_JUMP_IF_FALSE, // GET_LOCAL, CONST, LESS, JUMP_IF_FALSE, POP
+    // quickened forms, run() rewrites code in place after seeing operand
+    // types and back to the generic op when a guard fails.
+    OP_ADD_NUM, // ADD of two numbers
+    OP_CALL_CLOSURE, // CALL of a closure with matching arity
+    OP_CALL_FUNCTION, // CALL of a bare function with matching arity
+    // opcodes count, keep it last.
+    OP_CODE_COUNT,
 } OP_CODE;
 
 typedef struct {
@@ -73,4 +87,20 @@ extern int chunk_add_constant(Chunk *t, Value constant);
 
 extern void chunk_destroy(Chunk* t);
 
+// size in bytes of instruction at offset, operands included.
+extern int chunk_instruction_length(Chunk* t, int offset);
+
+// stack depth change made by instruction at offset.
+extern int chunk_stack_effect(Chunk* t, int offset);
+
+// depth before every instruction (-1 if unreachable), starting with
+// entry_depth at offset 0. Returns max depth, -1 if paths disagree.
+extern int chunk_stack_depths(Chunk* t, int entry_depth, int* depth_at);
+
+// max stack depth only.
+extern int chunk_max_stack(Chunk* t, int entry_depth);
+
+// generic opcode of a quickened one, `op` itself otherwise.
+extern uint8_t chunk_generic_op(uint8_t op);
+
 #endif
\ No newline at end of file
@@ -6,6 +6,20 @@
 #include "stdint.h"
 #include "stdio.h"
 
+// debug build: tracing hooks compiled in, switched on at runtime (trace.h).
+// release build (Makefile PROFILE=release) has none of it in run().
+#ifndef VM_RELEASE
 #define DEBUG_TRACE_EXECUTION
+#define DEBUG_PRINT_CODE
+#endif
+
+// run gc on every allocation / log gc work.
+//#define DEBUG_STRESS_GC
+//#define DEBUG_LOG_GC
+
+// threaded dispatch needs GCC/Clang labels-as-values.
+#if defined(VM_COMPUTED_GOTO) && !defined(__GNUC__)
+#undef VM_COMPUTED_GOTO
+#endif
 
 #endif
\ No newline at end of file
@@ -2,8 +2,10 @@
 #include "debug.h"
 #include "object.h"
 #include "string.h"
-
-#define DEBUG_PRINT_CODE
+#include "gc.h"
+#include "optimizer.h"
+#include "regvm.h"
+#include "trace.h"
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 #define SWITCH_MAX_CASES 64
@@ -26,7 +28,7 @@ typedef struct {
 } ClosureUpvalue;
 
 
-typedef struct {
+typedef struct Compiler {
     struct Compiler* enclosing;
     
     ObjFunction* function;
@@ -37,7 +39,9 @@ typedef struct {
     Local locals[UINT8_COUNT];
 
     ClosureUpvalue upvalues[UINT8_COUNT];
-    
+
+    // offset of the latest OP_CALL, -1 - none yet.
+    int last_call;
 } Compiler;
 
 typedef struct {
@@ -69,13 +73,23 @@ typedef struct  {
     PrecedenceOrder prec;
 } ParseRule;
 
-Parser parser;
-Compiler* current_comp = NULL;
-Chunk* compiling_chunk;
-Hashtable string_constants;
+// the grammar is recursive, used before they are defined.
+void advance();
+void emit_byte(uint8_t byte);
+void expression();
+void statement();
+void declaration();
+void var_decl();
+void compiler_init(Compiler* comp, FunctionType type);
+
+// per thread: isolates on different threads compile concurrently.
+_Thread_local Parser parser;
+_Thread_local Compiler* current_comp = NULL;
+_Thread_local Chunk* compiling_chunk;
+_Thread_local Hashtable string_constants;
 
-int deepest_loop_offset = -1;
-int deepest_loop_depth = -1;
+_Thread_local int deepest_loop_offset = -1;
+_Thread_local int deepest_loop_depth = -1;
 
 void error_at(Token* token, const char* msg) {
     fprintf(stderr, "[line %d] Error", token->line);
@@ -188,6 +202,7 @@ Chunk* current_chunk() {
 
 uint8_t make_constant(Value reprValue) {
     int const_index = chunk_add_constant(current_chunk(), reprValue);
+    GC_WRITE_BARRIER(current_comp->function, reprValue);
 
     if (const_index > UINT8_MAX) {
         error("too many constants in one chunk.");
@@ -214,6 +229,12 @@ void emit_bytes(uint8_t byte1, uint8_t byte2) {
     emit_byte(byte2);
 };
 
+void emit_op_short(uint8_t op, uint16_t operand) {
+    emit_byte(op);
+    emit_byte((operand >> 8) & 0xff);
+    emit_byte(operand & 0xff);
+};
+
 void emit_constant(Value value) {
     emit_bytes(OP_CONST, make_constant(value));
 }
@@ -222,14 +243,43 @@ ObjFunction* end_compiler() {
     emit_op_return();
 
     ObjFunction* function = current_comp->function;
-
     #ifdef DEBUG_PRINT_CODE
-    if (!parser.had_error) {
-        disassembleChunk(current_chunk(), function->name != NULL ?
-            function->name->chars : "<script>");
+    const char* name = function->name != NULL ? function->name->chars : "<script>";
+    if (trace.code && !parser.had_error) {
+        disassembleChunk(current_chunk(), name);
+    }
+    #endif
+
+    if (vm.backend == BACKEND_REGISTER && !parser.had_error) {
+        // translated from plain stack code, before the optimizer.
+        if (!reg_compile(function)) {
+            error("Function is too large for register backend.");
+        }
+
+        #ifdef DEBUG_PRINT_CODE
+        if (trace.code && !parser.had_error) disassembleRegChunk(function, name);
+        #endif
+    }
+
+    #ifdef COMPILER_OPTIMIZE
+    if (!parser.had_error && vm.backend == BACKEND_STACK) {
+        optimize_chunk(current_chunk());
+
+        #ifdef DEBUG_PRINT_CODE
+        if (trace.code) {
+            char title[128];
+            snprintf(title, sizeof(title), "%s (optimized)", name);
+            disassembleChunk(current_chunk(), title);
+        }
+        #endif
     }
     #endif
 
+    if (!parser.had_error) {
+        function->max_slots = chunk_max_stack(current_chunk(), 1 + function->arity);
+        if (function->max_slots < 0) error("Inconsistent stack depth.");
+    }
+
     // clear constant cache
     //destroy_hashtable(&string_constants);
 
@@ -253,23 +303,15 @@ void comp_string(bool canAssign) {
         parser.previous.start+1, parser.previous.length-2)));
 };
 
-uint8_t make_id_constant(Token* name) {
-
-    /*
-    ObjString* str = copy_string(name->start, name->length);
-    Value index;
-    if (hashtable_get(&string_constants, str, &index)) {
-        return (uint8_t)AS_NUMBER(index);
+// globals are resolved to vm slots while compiling.
+uint16_t make_global_slot(Token* name) {
+    int slot = vm_global_slot(copy_string(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
     }
-   
-    uint8_t const_index = make_constant(OBJ_VAL(str));
-    hashtable_set(&string_constants, str, NUMBER_VAL((double)const_index));
-    
-    return const_index;
-    */
 
-    return make_constant(OBJ_VAL(copy_string(name->start,
-        name->length)));
+    return (uint16_t)slot;
 };
 
 // ----------------- JUMBS
@@ -306,7 +348,7 @@ void emit_loop(int loopStart) {
 
 
 void unary(bool canAssign);
-void binary();
+void binary(bool canAssign);
 void grouping(bool canAssign);
 void literal(bool canAssign);
 void variable(bool canAssign);
@@ -418,7 +460,7 @@ void unary(bool canAssign) {
     }
 };
 
-void binary() {
+void binary(bool canAssign) {
     TOKEN_TYPE operator = parser.previous.type;
     ParseRule* rule = get_rule(operator);
     parse_precedence((PrecedenceOrder)(rule->prec + 1));
@@ -513,8 +555,9 @@ void if_statement() {
     if (match_token(TOKEN_ELSE)) {
         consume(TOKEN_LEFT_BRACE, "Expect '{' after expr in Else");
         block();
-        patch_jump(else_jump);
     }
+
+    patch_jump(else_jump);
 };
 
 // ------------------ LOOPS
@@ -628,7 +671,7 @@ void switch_() {
     int index = 0;
 
     // parse case
-    while(match_token(TOKEN_CASE) || match_token(TOKEN_DEFAULT) && index < SWITCH_MAX_CASES) {
+    while(index < SWITCH_MAX_CASES && (match_token(TOKEN_CASE) || match_token(TOKEN_DEFAULT))) {
         // patch previous case.
         if (prev_case_jump > 0) {
             patch_jump(prev_case_jump);
@@ -705,6 +748,14 @@ void return_statement() {
         // return value
         expression();
 
+        // value is a call made last: it runs in this frame (tail call).
+        // OP_RET stays, `and`/`or` jumps land on it and natives return
+        // through it.
+        Chunk* chunk = current_chunk();
+        if (current_comp->last_call == chunk->count - 2) {
+            chunk->code[current_comp->last_call] = OP_TAIL_CALL;
+        }
+
         consume(TOKEN_SEMICOLON, "Expect ';' after return statement.");
         emit_byte(OP_RET);
     }
@@ -788,13 +839,13 @@ void declare_variable() {
     add_local(*name);
 };
 
-uint8_t parse_variable(const char* errorMsg) {
+uint16_t parse_variable(const char* errorMsg) {
     consume(TOKEN_ID, errorMsg);
 
     declare_variable();
     if (current_comp->scope_depth > 0) return 0;
 
-    return make_id_constant(&parser.previous);
+    return make_global_slot(&parser.previous);
 };
 
 int add_upvalue(Compiler* compiler, uint8_t index, bool isLocal) {
@@ -856,18 +907,20 @@ void named_variable(Token token, bool canAssign) {
     }
     else {
         // its global var
-        arg = make_id_constant(&token);
+        arg = make_global_slot(&token);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
+    bool is_global = getOp == OP_GET_GLOBAL;
+    uint8_t op = getOp;
     if (canAssign && match_token(TOKEN_EQ)) {
         expression(); // parse arg
-        emit_bytes(setOp, (uint8_t)arg);
-    }
-    else {
-        emit_bytes(getOp, (uint8_t)arg);
+        op = setOp;
     }
+
+    if (is_global) emit_op_short(op, (uint16_t)arg);
+    else emit_bytes(op, (uint8_t)arg);
 } 
 
 void variable(bool canAssign) {
@@ -881,7 +934,7 @@ void markInitialized() {
     current_comp->locals[current_comp->local_count - 1].depth = current_comp->scope_depth;
 }
 
-void define_variable(uint8_t global) {
+void define_variable(uint16_t global) {
 
     // pass code for local vars
     if (current_comp->scope_depth > 0) {
@@ -889,11 +942,11 @@ void define_variable(uint8_t global) {
         return;
     }
 
-    emit_bytes(OP_DEFINE_GLOBAL, global);
+    emit_op_short(OP_DEFINE_GLOBAL, global);
 }
 
 void var_decl() {
-    uint8_t global = parse_variable("Expect a variable name.");
+    uint16_t global = parse_variable("Expect a variable name.");
     if (match_token(TOKEN_EQ)) {
         // var foo = ...;
         COMPILER_DEBUG_LOG("var_decl.expr()\n");
@@ -924,7 +977,7 @@ void function_impl(FunctionType type) {
                 error_at_current("Can't have more than 255 params in function.");
             }
 
-            uint8_t constant = parse_variable("Expect a parameter name.");
+            uint16_t constant = parse_variable("Expect a parameter name.");
             define_variable(constant); // define variable in CURRENT function
         } while(match_token(TOKEN_COMMA));
     }
@@ -952,7 +1005,7 @@ void function_impl(FunctionType type) {
 }
 
 void function_decl() {
-    uint8_t global=  parse_variable("Expect function name.");
+    uint16_t global=  parse_variable("Expect function name.");
     markInitialized();
     function_impl(FTYPE_FUNCTION);
     define_variable(global);
@@ -996,6 +1049,7 @@ int argument_list() {
 
 void call(bool canAssign) {
     uint8_t arg_count = argument_list();
+    current_comp->last_call = current_chunk()->count;
     emit_bytes(OP_CALL, arg_count);
 };
 
@@ -1049,6 +1103,14 @@ ObjFunction* compile(const char* source) {
     return parser.had_error ? NULL : function;
 };
 
+void compiler_mark_roots() {
+    Compiler* comp = current_comp;
+    while (comp != NULL) {
+        gc_mark_object((Obj*)comp->function);
+        comp = (Compiler*)comp->enclosing;
+    }
+};
+
 void dump_pass() {
     int line = -1;
     for (;;) {
@@ -1074,6 +1136,7 @@ void compiler_init(Compiler* comp, FunctionType type) {
     COMPILER_DEBUG_LOG("compiler_init\n");
     comp->local_count = 0;
     comp->scope_depth = 0;
+    comp->last_call = -1;
     comp->function = new_function();
     comp->function_type = type;
     current_comp = comp;
@@ -1082,6 +1145,7 @@ void compiler_init(Compiler* comp, FunctionType type) {
         // copy function name
         current_comp->function->name = copy_string(parser.previous.start, 
             parser.previous.length);
+        GC_WRITE_BARRIER(current_comp->function, OBJ_VAL(current_comp->function->name));
     }
 
     // init constant cache
@@ -15,4 +15,7 @@
 
 ObjFunction* compile(const char* source);
 
+// functions being compiled are gc roots.
+void compiler_mark_roots();
+
 #endif
\ No newline at end of file
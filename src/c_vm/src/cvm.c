@@ -0,0 +1,58 @@
+#include "cvm.h"
+#include "vm.h"
+#include "compiler.h"
+#include "cache.h"
+#include "stdlib.h"
+
+VM* cvm_new(const CvmOptions* options) {
+    VM* isolate = (VM*)malloc(sizeof(VM));
+    if (isolate == NULL) return NULL;
+
+    VM* previous = vm_current;
+    vm_current = isolate;
+    vm_init();
+    if (options != NULL) {
+        vm.backend = options->register_backend ? BACKEND_REGISTER : BACKEND_STACK;
+        vm.use_cache = options->use_cache;
+    }
+    vm_current = previous;
+
+    return isolate;
+};
+
+void cvm_free(VM* isolate) {
+    if (isolate == NULL) return;
+
+    VM* previous = vm_current;
+    vm_current = isolate;
+    vm_destroy();
+    vm_current = previous;
+
+    free(isolate);
+};
+
+INTERPRET_RESULT cvm_run(VM* isolate, const char* source, const char* path) {
+    VM* previous = vm_current;
+    vm_current = isolate;
+
+    bool use_cache = vm.use_cache && path != NULL;
+    ObjFunction* script = use_cache ? cache_load(path, source) : NULL;
+    if (script == NULL) {
+        script = compile(source);
+        if (script != NULL && use_cache) cache_store(path, source, script);
+    }
+
+    INTERPRET_RESULT result = script != NULL
+        ? vm_interpret_function(script)
+        : INTERPRET_COMPILE_ERROR;
+
+    vm_current = previous;
+    return result;
+};
+
+void cvm_reset(VM* isolate) {
+    VM* previous = vm_current;
+    vm_current = isolate;
+    vm_reset_globals();
+    vm_current = previous;
+};
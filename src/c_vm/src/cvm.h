@@ -0,0 +1,44 @@
+#ifndef CVM_API_H
+#define CVM_API_H
+
+#include "stdbool.h"
+
+/*
+    Embedding API: independent vm isolates.
+
+    Each isolate owns its heap, strings, globals, stack and gc, nothing is
+    shared between isolates. A thread runs one isolate at a time: every
+    cvm_* call binds the isolate to the calling thread for its duration
+    (compiler state is per thread too), so one isolate per worker thread
+    needs no locking. An isolate must not be used by two threads at once.
+
+    Process-wide debug facilities of main (--profile, --trace*) are not
+    part of it and assume a single running isolate.
+*/
+
+typedef struct VM VM;
+
+typedef enum {
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR
+} INTERPRET_RESULT;
+
+typedef struct {
+    bool register_backend; // regvm.h instead of stack vm
+    bool use_cache; // bytecode cache next to the source (cache.h)
+} CvmOptions;
+
+// new isolate with natives defined, NULL options - defaults.
+VM* cvm_new(const CvmOptions* options);
+void cvm_free(VM* isolate);
+
+// compile and run `source`. Globals stay in the isolate between runs.
+// `path` is the script file for the bytecode cache, NULL - no cache.
+INTERPRET_RESULT cvm_run(VM* isolate, const char* source, const char* path);
+
+// forget globals of previous runs, keep the heap: the next script starts
+// clean without paying for a new isolate.
+void cvm_reset(VM* isolate);
+
+#endif
@@ -4,35 +4,48 @@
 #include "debug.h"
 //> Closures debug-include-object
 #include "object.h"
+#include "vm.h"
+#include "regvm.h"
 
-void print_function(ObjFunction* func) {
+static void print_function(FILE* out, ObjFunction* func) {
     if (func->name != NULL) {
-        printf("<fn %s>", func->name->chars);
+        fprintf(out, "<fn %s>", func->name->chars);
     }
-    else printf("<script>");
+    else fprintf(out, "<script>");
 };
 
-void print_object(Value v) {
+static void print_chars(const char* chars, int length, void* out) {
+    fwrite(chars, 1, length, (FILE*)out);
+};
+
+static void print_object(FILE* out, Value v) {
     switch (OBJ_TYPE(v))
     {
       case OBJ_CLOSURE:
-        print_function(AS_CLOSURE(v)->function);
+        print_function(out, AS_CLOSURE(v)->function);
         break;
 
     case OBJ_STRING:
-        printf("\"%s\"", AS_CSTRING(v));
+        fprintf(out, "\"%s\"", AS_CSTRING(v));
+        break;
+
+    case OBJ_ROPE:
+        // walked, not flattened: printing must not allocate.
+        fputc('"', out);
+        rope_each(AS_ROPE(v), print_chars, out);
+        fputc('"', out);
         break;
 
     case OBJ_FUNCTION:
-        print_function(AS_FUNCTION(v));
+        print_function(out, AS_FUNCTION(v));
         break;
 
     case OBJ_NATIVE:
-        printf("<native fn>");
+        fprintf(out, "<native fn>");
         break;
 
     case OBJ_UPVALUE:
-      printf("<upvalue>");
+      fprintf(out, "<upvalue>");
       break;
 
     default:
@@ -40,22 +53,65 @@ void print_object(Value v) {
     }
 };
 
+void fprint_value(FILE* out, Value v) {
+    if (IS_BOOL(v)) fprintf(out, AS_BOOL(v) ? "True" : "False");
+    else if (IS_NULL(v)) fprintf(out, "Null");
+    else if (IS_NUMBER(v)) fprintf(out, "%g", AS_NUMBER(v));
+    else if (IS_OBJ(v)) print_object(out, v);
+};
+
 void print_value(Value v) {
-    switch (v.type)
-    {
-    case VALUE_BOOL: printf(AS_BOOL(v) ? "True" : "False"); break;
-    case VALUE_NULL: printf("Null"); break;
-    case VALUE_NUMBER: printf("%g", AS_NUMBER(v)); break;
-    case VALUE_OBJ: print_object(v); break;
+    fprint_value(stdout, v);
+};
 
-    default:
-        return;
-    }
+// print statement: whole line under stdout lock, isolates on other
+// threads can't split it.
+void print_line(Value v) {
+    flockfile(stdout);
+    fprint_value(stdout, v);
+    putc('\n', stdout);
+    funlockfile(stdout);
 };
 
+// disassembler output, stdout unless trace sink is set.
+static FILE* debug_out = NULL;
+
+void debug_set_output(FILE* out) {
+    debug_out = out;
+};
+
+static FILE* output() {
+    return debug_out != NULL ? debug_out : stdout;
+};
+
+static const char* opNames[OP_CODE_COUNT] = {
+  [OP_RET] = "OP_RETURN", [OP_CONST] = "OP_CONST", [OP_NEGATE] = "OP_NEGATE",
+  [OP_ADD] = "OP_ADD", [OP_SUB] = "OP_SUBTRACT", [OP_MUL] = "OP_MULTIPLY",
+  [OP_DIV] = "OP_DIVIDE", [OP_NULL] = "OP_NIL", [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE", [OP_NOT] = "OP_NOT", [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER", [OP_LESS] = "OP_LESS", [OP_PRINT] = "OP_PRINT",
+  [OP_POP] = "OP_POP", [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL", [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL", [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE", [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+  [OP_JUMP] = "OP_JUMP", [OP_LOOP] = "OP_LOOP", [OP_DUP] = "OP_DUP",
+  [OP_CALL] = "OP_CALL", [OP_TAIL_CALL] = "OP_TAIL_CALL", [OP_CLOSURE] = "OP_CLOSURE",
+  [OP_GET_UPVALUE] = "OP_GET_UPVALUE", [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+  [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE", [OP_ADD_LOCAL_CONST] = "OP_ADD_LOCAL_CONST",
+  [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+  [OP_LESS_LOCALS_JUMP_IF_FALSE] = "OP_LESS_LOCALS_JUMP_IF_FALSE",
+  [OP_LESS_LOCAL_CONST_JUMP_IF_FALSE] = "OP_LESS_LOCAL_CONST_JUMP_IF_FALSE",
+  [OP_ADD_NUM] = "OP_ADD_NUM", [OP_CALL_CLOSURE] = "OP_CALL_CLOSURE",
+  [OP_CALL_FUNCTION] = "OP_CALL_FUNCTION",
+};
+
+const char* opcode_name(uint8_t op) {
+  return op < OP_CODE_COUNT ? opNames[op] : NULL;
+}
+
 
 void disassembleChunk(Chunk* chunk, const char* name) {
-  printf("== %s ==\n", name);
+  fprintf(output(), "== %s ==\n", name);
   
   for (int offset = 0; offset < chunk->count;) {
     offset = disassembleInstruction(chunk, offset);
@@ -65,28 +121,28 @@ void disassembleChunk(Chunk* chunk, const char* name) {
 static int constantInstruction(const char* name, Chunk* chunk,
                                int offset) {
   uint8_t constant = chunk->code[offset + 1];
-  printf("%-16s %4d '", name, constant);
-  print_value(chunk->constants.values[constant]);
-  printf("'\n");
+  fprintf(output(), "%-16s %4d '", name, constant);
+  fprint_value(output(), chunk->constants.values[constant]);
+  fprintf(output(), "'\n");
 //> return-after-operand
   return offset + 2;
 //< return-after-operand
 }
 //< constant-instruction
-//> Methods and Initializers invoke-instruction
-static int invokeInstruction(const char* name, Chunk* chunk,
-                                int offset) {
-  uint8_t constant = chunk->code[offset + 1];
-  uint8_t argCount = chunk->code[offset + 2];
-  printf("%-16s (%d args) %4d '", name, argCount, constant);
-  print_value(chunk->constants.values[constant]);
-  printf("'\n");
+static int globalInstruction(const char* name, Chunk* chunk,
+                             int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  fprintf(output(), "%-16s %4d '", name, slot);
+  if (slot < vm.global_names.count) {
+    fprint_value(output(), vm.global_names.values[slot]);
+  }
+  fprintf(output(), "'\n");
   return offset + 3;
 }
-//< Methods and Initializers invoke-instruction
 //> simple-instruction
 static int simpleInstruction(const char* name, int offset) {
-  printf("%s\n", name);
+  fprintf(output(), "%s\n", name);
   return offset + 1;
 }
 //< simple-instruction
@@ -94,7 +150,7 @@ static int simpleInstruction(const char* name, int offset) {
 static int byteInstruction(const char* name, Chunk* chunk,
                            int offset) {
   uint8_t slot = chunk->code[offset + 1];
-  printf("%-16s %4d\n", name, slot);
+  fprintf(output(), "%-16s %4d\n", name, slot);
   return offset + 2; // [debug]
 }
 //< Local Variables byte-instruction
@@ -103,26 +159,56 @@ static int jumpInstruction(const char* name, int sign,
                            Chunk* chunk, int offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
   jump |= chunk->code[offset + 2];
-  printf("%-16s %4d -> %d\n", name, offset,
+  fprintf(output(), "%-16s %4d -> %d\n", name, offset,
          offset + 3 + sign * jump);
   return offset + 3;
 }
 //< Jumping Back and Forth jump-instruction
+static int localConstInstruction(const char* name, Chunk* chunk,
+                                 int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  fprintf(output(), "%-16s %4d %4d '", name, slot, constant);
+  fprint_value(output(), chunk->constants.values[constant]);
+  fprintf(output(), "'\n");
+  return offset + 3;
+}
+
+// LESS + JUMP_IF_FALSE superinstructions: slot, slot|constant, jump.
+static int lessJumpInstruction(Chunk* chunk, int offset) {
+  uint8_t instruction = chunk->code[offset];
+  uint8_t a = chunk->code[offset + 1];
+  uint8_t b = chunk->code[offset + 2];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+  jump |= chunk->code[offset + 4];
+
+  if (instruction == OP_LESS_LOCALS_JUMP_IF_FALSE) {
+    fprintf(output(), "%-16s %4d %4d", "OP_LESS_LOCALS_JUMP_IF_FALSE", a, b);
+  } else {
+    fprintf(output(), "%-16s %4d '", "OP_LESS_LOCAL_CONST_JUMP_IF_FALSE", a);
+    fprint_value(output(), chunk->constants.values[b]);
+    fprintf(output(), "'");
+  }
+  fprintf(output(), " -> %d\n", offset + 5 + jump);
+  return offset + 5;
+}
 //> disassemble-instruction
 int disassembleInstruction(Chunk* chunk, int offset) {
-  printf("%04d ", offset);
+  fprintf(output(), "%04d ", offset);
 //> show-location
   if (offset > 0 &&
       chunk->lines[offset] == chunk->lines[offset - 1]) {
-    printf("   | ");
+    fprintf(output(), "   | ");
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    fprintf(output(), "%4d ", chunk->lines[offset]);
   }
 //< show-location
   
   uint8_t instruction = chunk->code[offset];
   switch (instruction) {
 //> disassemble-constant
+    case OP_RET:
+      return simpleInstruction("OP_RETURN", offset);
     case OP_CONST:
       return constantInstruction("OP_CONST", chunk, offset);
 //< disassemble-constant
@@ -146,16 +232,15 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 //< Local Variables disassemble-local
 //> Global Variables disassemble-get-global
     case OP_GET_GLOBAL:
-      return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+      return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 //< Global Variables disassemble-get-global
 //> Global Variables disassemble-define-global
     case OP_DEFINE_GLOBAL:
-      return constantInstruction("OP_DEFINE_GLOBAL", chunk,
-                                 offset);
+      return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 //< Global Variables disassemble-define-global
 //> Global Variables disassemble-set-global
     case OP_SET_GLOBAL:
-      return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+      return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 
 //< Superclasses disassemble-get-super
 //> Types of Values disassemble-comparison
@@ -169,6 +254,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 //> A Virtual Machine disassemble-binary
     case OP_ADD:
       return simpleInstruction("OP_ADD", offset);
+    case OP_ADD_NUM:
+      return simpleInstruction("OP_ADD_NUM", offset);
     case OP_SUB:
       return simpleInstruction("OP_SUBTRACT", offset);
     case OP_MUL:
@@ -193,6 +280,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return jumpInstruction("OP_JUMP", 1, chunk, offset);
     case OP_JUMP_IF_FALSE:
       return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+      return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
 //< Jumping Back and Forth disassemble-jump
 //> Jumping Back and Forth disassemble-loop
     case OP_LOOP:
@@ -201,6 +290,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 //> Calls and Functions disassemble-call
     case OP_CALL:
       return byteInstruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+      return byteInstruction("OP_TAIL_CALL", chunk, offset);
+    case OP_CALL_CLOSURE:
+      return byteInstruction("OP_CALL_CLOSURE", chunk, offset);
+    case OP_CALL_FUNCTION:
+      return byteInstruction("OP_CALL_FUNCTION", chunk, offset);
 
     case OP_GET_UPVALUE:
         return byteInstruction("OP_GET_UPVALUE", chunk, offset);
@@ -209,30 +304,193 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         return byteInstruction("OP_SET_UPVALUE", chunk, offset);
 
       case OP_CLOSE_UPVALUE:
-        return byteInstruction("OP_CLOSE_UPVALUE", chunk, offset);
+        return simpleInstruction("OP_CLOSE_UPVALUE", offset);
 
     case OP_CLOSURE:
       offset++;
       uint8_t constant = chunk->code[offset++];
-      printf("%-16s %4d ", "OP_CLOSURE", constant);
-      print_value(chunk->constants.values[constant]);
-      printf("\n");
+      fprintf(output(), "%-16s %4d ", "OP_CLOSURE", constant);
+      fprint_value(output(), chunk->constants.values[constant]);
+      fprintf(output(), "\n");
 
       ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
       for (int i = 0; i < function->upvalue_count; i++) {
         int is_local = chunk->code[offset++];
         int index = chunk->code[offset++];
-        printf("%04d  |\t\t\t\t%s %d\n", offset-2, is_local ? "local" : "upval", index);
+        fprintf(output(), "%04d  |\t\t\t\t%s %d\n", offset-2, is_local ? "local" : "upval", index);
       }
 
       return offset;
 
-    //case OP_RET:
-       // return printf("OP_RET\n"); return offset+1;
+    case OP_ADD_LOCAL_CONST:
+      return localConstInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+
+    case OP_SET_LOCAL_POP:
+      return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+
+    case OP_LESS_LOCALS_JUMP_IF_FALSE:
+    case OP_LESS_LOCAL_CONST_JUMP_IF_FALSE:
+      return lessJumpInstruction(chunk, offset);
 
     default:
-      printf("Unknown opcode %d\n", instruction);
+      fprintf(output(), "Unknown opcode %d\n", instruction);
       return offset + 1;
   }
 }
 //< disassemble-instruction
+
+// ------------ REGISTER BACKEND
+
+static void printRK(ObjFunction* function, uint8_t operand) {
+  if (operand & REG_RK_CONST) {
+    fprintf(output(), " k%d'", operand & REG_RK_MAX);
+    fprint_value(output(), function->chunk.constants.values[operand & REG_RK_MAX]);
+    fprintf(output(), "'");
+  } else {
+    fprintf(output(), " r%d", operand);
+  }
+}
+
+static const char* regNames[REG_CODE_COUNT] = {
+    [REG_MOVE] = "MOVE", [REG_LOADK] = "LOADK", [REG_NULL] = "NULL",
+    [REG_TRUE] = "TRUE", [REG_FALSE] = "FALSE", [REG_NEGATE] = "NEGATE",
+    [REG_NOT] = "NOT", [REG_ADD] = "ADD", [REG_SUB] = "SUB",
+    [REG_MUL] = "MUL", [REG_DIV] = "DIV", [REG_EQUAL] = "EQUAL",
+    [REG_GREATER] = "GREATER", [REG_LESS] = "LESS", [REG_PRINT] = "PRINT",
+    [REG_DEFINE_GLOBAL] = "DEFINE_GLOBAL", [REG_SET_GLOBAL] = "SET_GLOBAL",
+    [REG_GET_GLOBAL] = "GET_GLOBAL", [REG_GET_UPVALUE] = "GET_UPVALUE",
+    [REG_SET_UPVALUE] = "SET_UPVALUE", [REG_CLOSE_UPVALUE] = "CLOSE_UPVALUE",
+    [REG_JUMP] = "JUMP", [REG_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [REG_LOOP] = "LOOP", [REG_CALL] = "CALL", [REG_TAIL_CALL] = "TAIL_CALL",
+    [REG_CLOSURE] = "CLOSURE",
+    [REG_RETURN] = "RETURN",
+};
+
+const char* reg_opcode_name(uint8_t op) {
+  return op < REG_CODE_COUNT ? regNames[op] : NULL;
+}
+
+void disassembleRegChunk(ObjFunction* function, const char* name) {
+  fprintf(output(), "== %s (registers: %d) ==\n", name, function->reg_count);
+
+  for (int offset = 0; offset < function->reg_chunk.count;) {
+    offset = disassembleRegInstruction(function, offset);
+  }
+}
+
+int disassembleRegInstruction(ObjFunction* function, int offset) {
+  Chunk* chunk = &function->reg_chunk;
+  uint8_t* code = &chunk->code[offset];
+  int length = reg_instruction_length(function, offset);
+
+  fprintf(output(), "%04d ", offset);
+  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    fprintf(output(), "   | ");
+  } else {
+    fprintf(output(), "%4d ", chunk->lines[offset]);
+  }
+
+  if (code[0] >= REG_CODE_COUNT) {
+    fprintf(output(), "Unknown opcode %d\n", code[0]);
+    return offset + 1;
+  }
+  fprintf(output(), "%-14s", regNames[code[0]]);
+
+  switch (code[0]) {
+    case REG_MOVE:
+    case REG_NEGATE:
+    case REG_NOT:
+      fprintf(output(), " r%d", code[1]);
+      printRK(function, code[2]);
+      break;
+
+    case REG_LOADK:
+      fprintf(output(), " r%d k%d'", code[1], code[2]);
+      fprint_value(output(), function->chunk.constants.values[code[2]]);
+      fprintf(output(), "'");
+      break;
+
+    case REG_ADD:
+    case REG_SUB:
+    case REG_MUL:
+    case REG_DIV:
+    case REG_EQUAL:
+    case REG_GREATER:
+    case REG_LESS:
+      fprintf(output(), " r%d", code[1]);
+      printRK(function, code[2]);
+      printRK(function, code[3]);
+      break;
+
+    case REG_PRINT:
+    case REG_RETURN:
+      printRK(function, code[1]);
+      break;
+
+    case REG_DEFINE_GLOBAL:
+    case REG_SET_GLOBAL: {
+      int slot = (code[1] << 8) | code[2];
+      fprintf(output(), " g%d'", slot);
+      fprint_value(output(), vm.global_names.values[slot]);
+      fprintf(output(), "'");
+      printRK(function, code[3]);
+      break;
+    }
+
+    case REG_GET_GLOBAL: {
+      int slot = (code[2] << 8) | code[3];
+      fprintf(output(), " r%d g%d'", code[1], slot);
+      fprint_value(output(), vm.global_names.values[slot]);
+      fprintf(output(), "'");
+      break;
+    }
+
+    case REG_GET_UPVALUE:
+      fprintf(output(), " r%d u%d", code[1], code[2]);
+      break;
+
+    case REG_SET_UPVALUE:
+      fprintf(output(), " u%d", code[1]);
+      printRK(function, code[2]);
+      break;
+
+    case REG_NULL:
+    case REG_TRUE:
+    case REG_FALSE:
+    case REG_CLOSE_UPVALUE:
+      fprintf(output(), " r%d", code[1]);
+      break;
+
+    case REG_JUMP:
+    case REG_LOOP: {
+      int jump = (code[1] << 8) | code[2];
+      fprintf(output(), " -> %d", code[0] == REG_LOOP ? offset + 3 - jump : offset + 3 + jump);
+      break;
+    }
+
+    case REG_JUMP_IF_FALSE: {
+      int jump = (code[2] << 8) | code[3];
+      fprintf(output(), " r%d -> %d", code[1], offset + 4 + jump);
+      break;
+    }
+
+    case REG_CALL:
+    case REG_TAIL_CALL:
+      fprintf(output(), " r%d (%d args)", code[1], code[2]);
+      break;
+
+    case REG_CLOSURE:
+      fprintf(output(), " r%d ", code[1]);
+      fprint_value(output(), function->chunk.constants.values[code[2]]);
+      for (int i = 3; i < length; i += 2) {
+        fprintf(output(), " %s %d", code[i] ? "local" : "upval", code[i + 1]);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  fprintf(output(), "\n");
+  return offset + length;
+}
@@ -3,8 +3,25 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "object.h"
+
+// print statement output, stdout.
+void print_value(Value v);
+void print_line(Value v);
+void fprint_value(FILE* out, Value v);
+
+// disassembler output stream, stdout by default (trace.h sink).
+void debug_set_output(FILE* out);
+
+// disassembler names, NULL for unknown opcode.
+const char* opcode_name(uint8_t op);
+const char* reg_opcode_name(uint8_t op);
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
 
+// register backend code, function->reg_chunk.
+void disassembleRegChunk(ObjFunction* function, const char* name);
+int disassembleRegInstruction(ObjFunction* function, int offset);
+
 #endif
\ No newline at end of file
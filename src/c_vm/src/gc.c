@@ -0,0 +1,407 @@
+#include "gc.h"
+#include "vm.h"
+#include "object.h"
+#include "compiler.h"
+#include "string.h"
+
+#ifdef DEBUG_LOG_GC
+#include "debug.h"
+#endif
+
+#define NURSERY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+void gc_mark_object(Obj* t) {
+    if (t == NULL) return;
+    if (t->is_marked) return;
+
+    #ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void*)t);
+    print_value(OBJ_VAL(t));
+    printf("\n");
+    #endif
+
+    t->is_marked = true;
+
+    // gray stack lives outside of vm heap, it must not trigger collection.
+    if (vm.gray_capacity < vm.gray_count + 1) {
+        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+        vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+        if (vm.gray_stack == NULL) exit(1);
+    }
+
+    vm.gray_stack[vm.gray_count++] = t;
+};
+
+void gc_mark_value(Value v) {
+    if (IS_OBJ(v)) gc_mark_object(AS_OBJ(v));
+};
+
+static void mark_array(ValueArray* t) {
+    for (int i = 0; i < t->count; i++) {
+        gc_mark_value(t->values[i]);
+    }
+};
+
+static void mark_roots() {
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+        gc_mark_value(*slot);
+    }
+
+    for (int i = 0; i < vm.frames_count; i++) {
+        gc_mark_object(vm.frames[i].function);
+    }
+
+    for (ObjUpvalue* upv = vm.open_upvalues; upv != NULL; upv = upv->next) {
+        gc_mark_object((Obj*)upv);
+    }
+
+    hashtable_mark(&vm.globals);
+    mark_array(&vm.global_values);
+    mark_array(&vm.global_names);
+    compiler_mark_roots();
+};
+
+// mark everything the object refers to.
+static void blacken_object(Obj* t) {
+    #ifdef DEBUG_LOG_GC
+    printf("%p blacken ", (void*)t);
+    print_value(OBJ_VAL(t));
+    printf("\n");
+    #endif
+
+    switch (t->type)
+    {
+    case OBJ_UPVALUE:
+        gc_mark_value(((ObjUpvalue*)t)->closed);
+        break;
+
+    case OBJ_FUNCTION:
+        ObjFunction* func = (ObjFunction*)t;
+        gc_mark_object((Obj*)func->name);
+        mark_array(&func->chunk.constants);
+        break;
+
+    case OBJ_CLOSURE:
+        ObjClosure* closure = (ObjClosure*)t;
+        gc_mark_object((Obj*)closure->function);
+        for (int i = 0; i < closure->upvalues_count; i++) {
+            gc_mark_object((Obj*)closure->upvalues[i]);
+        }
+        break;
+
+    case OBJ_ROPE:
+        ObjRope* rope = (ObjRope*)t;
+        gc_mark_object(rope->left);
+        gc_mark_object(rope->right);
+        gc_mark_object((Obj*)rope->flat);
+        break;
+
+    case OBJ_STRING:
+    case OBJ_NATIVE:
+    default:
+        break;
+    }
+};
+
+static void trace_references() {
+    while (vm.gray_count > 0) {
+        Obj* t = vm.gray_stack[--vm.gray_count];
+        blacken_object(t);
+    }
+};
+
+static void sweep() {
+    Obj* prev = NULL;
+    Obj* t = vm.objects;
+    while (t != NULL) {
+        if (t->is_marked) {
+            t->is_marked = false;
+            prev = t;
+            t = t->next;
+            continue;
+        }
+
+        Obj* unreached = t;
+        t = t->next;
+        if (prev != NULL) {
+            prev->next = t;
+        } else {
+            vm.objects = t;
+        }
+
+        freeObj(unreached);
+    }
+};
+
+// old objects that won't survive sweep leave remembered set.
+static void remembered_remove_white() {
+    int count = 0;
+    for (int i = 0; i < vm.remembered_count; i++) {
+        Obj* t = vm.remembered[i];
+        if (t->is_marked) {
+            vm.remembered[count++] = t;
+        }
+    }
+
+    vm.remembered_count = count;
+};
+
+// young objects are not in vm.objects, sweep doesn't reset their marks.
+static void nursery_clear_marks() {
+    uint8_t* ptr = vm.nursery;
+    while (ptr < vm.nursery_top) {
+        Obj* t = (Obj*)ptr;
+        t->is_marked = false;
+        ptr += NURSERY_ALIGN(obj_size(t->type));
+    }
+};
+
+void gc_collect() {
+    #ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    size_t before = vm.bytes_allocated;
+    #endif
+
+    mark_roots();
+    trace_references();
+    hashtable_remove_white(&vm.strings);
+    remembered_remove_white();
+    sweep();
+    nursery_clear_marks();
+
+    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    if (vm.next_gc < GC_INITIAL_NEXT) vm.next_gc = GC_INITIAL_NEXT;
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+        before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+    #endif
+};
+
+// ------------ NURSERY
+
+void gc_nursery_init() {
+    vm.nursery = (uint8_t*)malloc(GC_NURSERY_SIZE);
+    if (vm.nursery == NULL) exit(1);
+    vm.nursery_top = vm.nursery;
+    vm.nursery_end = vm.nursery + GC_NURSERY_SIZE;
+    vm.nursery_full = false;
+
+    vm.remembered = NULL;
+    vm.remembered_count = 0;
+    vm.remembered_capacity = 0;
+};
+
+// free buffers owned by objects still in the nursery.
+void gc_nursery_destroy() {
+    uint8_t* ptr = vm.nursery;
+    while (ptr < vm.nursery_top) {
+        Obj* t = (Obj*)ptr;
+        if (t->next == NULL) freeObj_fields(t);
+        ptr += NURSERY_ALIGN(obj_size(t->type));
+    }
+
+    free(vm.nursery);
+    free(vm.remembered);
+    vm.nursery = vm.nursery_top = vm.nursery_end = NULL;
+};
+
+Obj* gc_nursery_alloc(size_t size) {
+    size = NURSERY_ALIGN(size);
+    if (vm.nursery_full || vm.nursery_top + size > vm.nursery_end) {
+        // keep allocating in old space until the next minor gc.
+        vm.nursery_full = true;
+        return NULL;
+    }
+
+    Obj* t = (Obj*)vm.nursery_top;
+    vm.nursery_top += size;
+    return t;
+};
+
+void gc_remember(Obj* owner) {
+    if (owner->is_remembered) return;
+    owner->is_remembered = true;
+
+    // lives outside of vm heap, as gray stack.
+    if (vm.remembered_capacity < vm.remembered_count + 1) {
+        vm.remembered_capacity = GROW_CAPACITY(vm.remembered_capacity);
+        vm.remembered = (Obj**)realloc(vm.remembered, sizeof(Obj*) * vm.remembered_capacity);
+        if (vm.remembered == NULL) exit(1);
+    }
+
+    vm.remembered[vm.remembered_count++] = owner;
+};
+
+// ------------ MINOR GC
+
+// copy young object to old space, returns its new address.
+// promoted copies are queued on gray stack to fix their fields.
+static Obj* promote(Obj* t) {
+    if (t == NULL || !t->is_young) return t;
+    if (t->next != NULL) return t->next; // already forwarded
+
+    size_t size = obj_size(t->type);
+
+    // no collection while objects are moving.
+    Obj* copy = (Obj*)malloc(size);
+    if (copy == NULL) exit(1);
+    vm.bytes_allocated += size;
+
+    memcpy(copy, t, size);
+    copy->is_young = false;
+    copy->is_marked = false;
+    copy->is_remembered = false;
+    copy->next = vm.objects;
+    vm.objects = copy;
+
+    if (t->type == OBJ_UPVALUE) {
+        // closed upvalue points on its own field.
+        ObjUpvalue* upv = (ObjUpvalue*)t;
+        if (upv->location == &upv->closed) {
+            ((ObjUpvalue*)copy)->location = &((ObjUpvalue*)copy)->closed;
+        }
+    }
+
+    t->next = copy;
+
+    if (vm.gray_capacity < vm.gray_count + 1) {
+        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+        vm.gray_stack = (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+        if (vm.gray_stack == NULL) exit(1);
+    }
+    vm.gray_stack[vm.gray_count++] = copy;
+
+    return copy;
+};
+
+static void promote_value(Value* v) {
+    if (GC_IS_YOUNG_VALUE(*v)) {
+        *v = OBJ_VAL(promote(AS_OBJ(*v)));
+    }
+};
+
+static void promote_fields(Obj* t) {
+    switch (t->type)
+    {
+    case OBJ_UPVALUE:
+        promote_value(&((ObjUpvalue*)t)->closed);
+        break;
+
+    case OBJ_FUNCTION:
+        ObjFunction* func = (ObjFunction*)t;
+        func->name = (ObjString*)promote((Obj*)func->name);
+        for (int i = 0; i < func->chunk.constants.count; i++) {
+            promote_value(&func->chunk.constants.values[i]);
+        }
+        break;
+
+    case OBJ_CLOSURE:
+        ObjClosure* closure = (ObjClosure*)t;
+        closure->function = (ObjFunction*)promote((Obj*)closure->function);
+        for (int i = 0; i < closure->upvalues_count; i++) {
+            closure->upvalues[i] = (ObjUpvalue*)promote((Obj*)closure->upvalues[i]);
+        }
+        break;
+
+    case OBJ_ROPE:
+        ObjRope* rope = (ObjRope*)t;
+        rope->left = promote(rope->left);
+        rope->right = promote(rope->right);
+        rope->flat = (ObjString*)promote((Obj*)rope->flat);
+        break;
+
+    case OBJ_STRING:
+    case OBJ_NATIVE:
+    default:
+        break;
+    }
+};
+
+static void promote_roots() {
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+        promote_value(slot);
+    }
+
+    for (int i = 0; i < vm.frames_count; i++) {
+        vm.frames[i].function = promote(vm.frames[i].function);
+    }
+
+    // open upvalues list is rewritten as a whole.
+    vm.open_upvalues = (ObjUpvalue*)promote((Obj*)vm.open_upvalues);
+    for (ObjUpvalue* upv = vm.open_upvalues; upv != NULL; upv = upv->next) {
+        upv->next = (ObjUpvalue*)promote((Obj*)upv->next);
+    }
+
+    if (vm.globals.has_young) {
+        for (int i = 0; i < vm.globals.capacity; i++) {
+            if (!HASHTABLE_SLOT_FULL(&vm.globals, i)) continue;
+            vm.globals.keys[i] = (ObjString*)promote((Obj*)vm.globals.keys[i]);
+            promote_value(&vm.globals.values[i]);
+        }
+        vm.globals.has_young = false;
+    }
+
+    if (vm.globals_has_young) {
+        for (int i = 0; i < vm.global_values.count; i++) {
+            promote_value(&vm.global_values.values[i]);
+            promote_value(&vm.global_names.values[i]);
+        }
+        vm.globals_has_young = false;
+    }
+
+    for (int i = 0; i < vm.remembered_count; i++) {
+        Obj* t = vm.remembered[i];
+        t->is_remembered = false;
+        promote_fields(t);
+    }
+    vm.remembered_count = 0;
+};
+
+// dead young objects release their buffers, strings table
+// follows promoted strings and forgets dead ones.
+static void nursery_sweep() {
+    uint8_t* ptr = vm.nursery;
+    while (ptr < vm.nursery_top) {
+        Obj* t = (Obj*)ptr;
+        ptr += NURSERY_ALIGN(obj_size(t->type));
+
+        if (t->next != NULL) {
+            if (t->type == OBJ_STRING) {
+                hashtable_replace_key(&vm.strings, (ObjString*)t, (ObjString*)t->next);
+            }
+            continue;
+        }
+
+        if (t->type == OBJ_STRING) {
+            hashtable_delete(&vm.strings, (ObjString*)t);
+        }
+        freeObj_fields(t);
+    }
+
+    vm.nursery_top = vm.nursery;
+    vm.nursery_full = false;
+    vm.strings.has_young = false;
+};
+
+void gc_minor() {
+    #ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
+    size_t young = vm.nursery_top - vm.nursery;
+    #endif
+
+    // major gc uses the same gray stack, it must be empty here.
+    promote_roots();
+    while (vm.gray_count > 0) {
+        Obj* t = vm.gray_stack[--vm.gray_count];
+        promote_fields(t);
+    }
+
+    nursery_sweep();
+
+    #ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   nursery had %zu bytes\n", young);
+    #endif
+};
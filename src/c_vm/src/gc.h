@@ -0,0 +1,65 @@
+#ifndef CVM_GC_H
+#define CVM_GC_H
+
+#include "common.h"
+#include "values.h"
+#include "object.h"
+
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_INITIAL_NEXT (1024 * 1024)
+
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)
+#endif
+
+/*
+    Generational heap.
+
+    Young: new objects are bump-allocated in the nursery. When it is full
+    allocation falls back to old space and vm.nursery_full is set; the vm
+    runs gc_minor() at its next safepoint (GC_SAFEPOINT in run()), where
+    no C local holds an object pointer. Minor gc copies reachable young
+    objects to old space (promotion) and resets the nursery.
+    Young object's `next` is its forwarding pointer once promoted.
+
+    Old: tracing mark-and-sweep (gc_collect), runs on allocation.
+    roots: vm stack, call frames, open upvalues, globals,
+    functions being compiled.
+    vm.strings is weak: unmarked strings are dropped before sweep.
+
+    Write barrier: an old object that gets a reference to a young one is
+    put in the remembered set; tables get has_young flag (hashtable_set).
+*/
+
+void gc_collect();
+void gc_minor();
+
+void gc_mark_object(Obj* t);
+void gc_mark_value(Value v);
+
+void gc_nursery_init();
+void gc_nursery_destroy();
+Obj* gc_nursery_alloc(size_t size);
+
+void gc_remember(Obj* owner);
+
+#define GC_IS_YOUNG_VALUE(value) \
+    (IS_OBJ(value) && AS_OBJ(value)->is_young)
+
+#define GC_WRITE_BARRIER(owner, value) \
+    do { \
+        if (!((Obj*)(owner))->is_young && GC_IS_YOUNG_VALUE(value)) { \
+            gc_remember((Obj*)(owner)); \
+        } \
+    } while (false)
+
+#ifdef DEBUG_STRESS_GC
+#define GC_SAFEPOINT() gc_minor()
+#else
+#define GC_SAFEPOINT() \
+    do { \
+        if (vm.nursery_full) gc_minor(); \
+    } while (false)
+#endif
+
+#endif
@@ -1,12 +1,14 @@
 #include "common.h"
 #include "stdio.h"
-#include "chunk.h"
-#include "vm.h"
+#include "cvm.h"
 #include "stdlib.h"
 #include "string.h"
-#include "tools/hashtable.h"
+#include "profiler.h"
+#include "trace.h"
+#include "batch.h"
+#include "tools/mapped_file.h"
 
-void repl() {
+void repl(VM* isolate) {
     char line[1024];
     for(;;) {
         printf("> ");
@@ -15,45 +17,20 @@ void repl() {
             break;
         }
 
-        vm_interpret_source(line);
+        cvm_run(isolate, line, NULL);
     }
 };
 
 
-char* readFile(const char* path) {
-    FILE* f = fopen(path, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "readFile: Can't open file with path='%s'.\n", path);
+void runFile(VM* isolate, const char* path) {
+    MappedFile source;
+    if (!mapped_file_open(&source, path)) {
+        fprintf(stderr, "runFile: Can't open file with path='%s'.\n", path);
         exit(2);
     }
 
-    fseek(f, 0L, SEEK_END);
-    size_t fsize = ftell(f);
-    rewind(f);
-
-    char* buffer = (char*)malloc(fsize+1);
-    if (buffer == NULL) {
-        fprintf(stderr, "readFile: not enough memory for malloc buffer.\n");
-        exit(74);
-    }
-
-    size_t bytesRead = fread(buffer, sizeof(char), fsize, f);
-    if (bytesRead < fsize) {
-        fprintf(stderr, "readFile: can't read file fully.\n");
-        exit(74);
-    }
-    
-    buffer[bytesRead] = '\0';
-    
-    fclose(f);
-    return buffer;
-};
-
-void runFile(const char* path) {
-    char* source =  readFile(path);
-    printf(":SOURCE=%s\n", source);
-    INTERPRET_RESULT result = vm_interpret_source(source);
-    free(source);
+    INTERPRET_RESULT result = cvm_run(isolate, source.chars, path);
+    mapped_file_close(&source);
 
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
@@ -61,23 +38,74 @@ void runFile(const char* path) {
 
 
 int main(int argc, const char* argv[]) {
-    
-    vm_init();
+    // --register: run on register backend (regvm.h).
+    // --no-cache: always compile, don't read or write bytecode cache.
+    // --profile <file>: sample call stacks, folded stacks to file at exit.
+    // --trace*: runtime tracing, see trace.h.
+    // --batch <dir|manifest>: run many scripts on a thread pool, see batch.h.
+    // --jobs N: batch worker threads, online cpus by default.
+    CvmOptions options = {.register_backend = false, .use_cache = true};
+    const char* profile_path = NULL;
+    const char* batch_path = NULL;
+    int jobs = 0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--register") == 0) {
+            options.register_backend = true;
+        } else if (strcmp(argv[arg], "--no-cache") == 0) {
+            options.use_cache = false;
+        } else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc) {
+            profile_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc) {
+            batch_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc) {
+            jobs = atoi(argv[++arg]);
+            if (jobs < 1) {
+                fprintf(stderr, "--jobs: expected a positive number.\n");
+                exit(64);
+            }
+        } else if (!trace_option(argv[arg])) {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[arg]);
+            exit(64);
+        }
+    }
+
+    if (batch_path != NULL) {
+        // profiler and trace sink are process-wide, one script at a time.
+        if (profile_path != NULL || trace.instructions || trace.code || arg != argc) {
+            fprintf(stderr, "Usage: vm [--register] [--no-cache] --batch <dir|manifest> [--jobs N]\n");
+            exit(64);
+        }
+        return batch_run(batch_path, &options, jobs > 0 ? jobs : batch_default_workers());
+    }
+
+    if (profile_path != NULL && !profiler_start(profile_path)) {
+        fprintf(stderr, "Can't start profiler.\n");
+        exit(64);
+    }
+
+    // chunk dumps need a real compile.
+    if (trace.code) options.use_cache = false;
+
+    VM* isolate = cvm_new(&options);
+    if (isolate == NULL) exit(1);
+    if (!trace_start(options.register_backend ? BACKEND_REGISTER : BACKEND_STACK)) exit(64);
 
-    if (argc == 1) {
+    if (arg == argc) {
         // read from stdin
-        repl();
+        repl(isolate);
     }
-    else if (argc == 2) {
+    else if (arg == argc - 1) {
         // run from file
-        runFile(argv[1]);
+        runFile(isolate, argv[arg]);
     }
     else {
-        fprintf(stderr, "Usage: vm [path]\n");
+        fprintf(stderr, "Usage: vm [--register] [--no-cache] [--profile file] [--trace...] [path]\n"
+                        "       vm [--register] [--no-cache] --batch <dir|manifest> [--jobs N]\n");
         exit(64);
     }
 
-    vm_destroy();
+    cvm_free(isolate);
 
     return 0;
 }; 
\ No newline at end of file
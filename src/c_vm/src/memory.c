@@ -1,9 +1,18 @@
 #include "memory.h"
+#include "vm.h"
+#include "gc.h"
 
 void* realloc_ptr(void* old_ptr, size_t old_size, size_t new_size) {
-    if (old_ptr == NULL) {
-        exit(1);
-        return NULL;
+    vm.bytes_allocated += new_size - old_size;
+
+    if (new_size > old_size) {
+        #ifdef DEBUG_STRESS_GC
+        gc_collect();
+        #else
+        if (vm.bytes_allocated > vm.next_gc) {
+            gc_collect();
+        }
+        #endif
     }
 
     if (new_size == 0) {
@@ -4,9 +4,11 @@
 #include "stdlib.h"
 
 
+// every heap allocation of the vm goes through it:
+// counts vm.bytes_allocated and may run the garbage collector.
 void* realloc_ptr(void* old_ptr, size_t old_size, size_t new_size) ;
 
-#define MEM_MALLOC(size) malloc(size)
+#define MEM_MALLOC(size) realloc_ptr(NULL, 0, size)
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
@@ -18,7 +20,7 @@ void* realloc_ptr(void* old_ptr, size_t old_size, size_t new_size) ;
     realloc_ptr(ptr, sizeof(type) * count, 0)
 
 #define ALLOCATE(type, count) \
-    (type*)malloc(sizeof(type) * count)
+    (type*)realloc_ptr(NULL, 0, sizeof(type) * (count))
 
 
 #define FREE(type, ptr) MEM_FREE(type, ptr, 1)
@@ -2,72 +2,94 @@
 #include "stdio.h"
 #include "string.h"
 #include "vm.h"
+#include "gc.h"
 
-bool is_obj_type(Value v, ObjType type) {
-    return IS_OBJ(v) && AS_OBJ(v)->type == type;
-};
-
-void free_upvalues(ObjClosure* closure) {
-    for (int i = 0; i < closure->upvalues_count; i++) {
-        free(closure->upvalues[i]);
+Obj* allocate_obj(size_t size, ObjType type) {
+    Obj* t = gc_nursery_alloc(size);
+    if (t != NULL) {
+        t->is_young = true;
+        t->next = NULL;
+    } else {
+        t = (Obj*)realloc_ptr(NULL, 0, size);
+        t->is_young = false;
+        t->next = vm.objects;
+        vm.objects = t;
     }
-}
 
-Obj* allocate_obj(size_t size, ObjType type) {
-    Obj* t = malloc(size);
     t->type = type;
-
-    t->next = vm.objects;
-    vm.objects = t;
+    t->is_marked = false;
+    t->is_remembered = false;
 
     return t;
 };
 
-void freeObj(Obj* t) {
+size_t obj_size(ObjType type) {
+    switch (type)
+    {
+    case OBJ_STRING: return sizeof(ObjString);
+    case OBJ_FUNCTION: return sizeof(ObjFunction);
+    case OBJ_NATIVE: return sizeof(ObjNative);
+    case OBJ_CLOSURE: return sizeof(ObjClosure);
+    case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+    case OBJ_ROPE: return sizeof(ObjRope);
+    default: return 0;
+    }
+};
+
+// free buffers owned by object, not object itself.
+void freeObj_fields(Obj* t) {
     switch (t->type)
     {
     case OBJ_STRING:
         ObjString* str = (ObjString*)t;
-        free(str->chars);
-        FREE(ObjString, t);
-        break;
-    
-    case OBJ_FUNCTION:
-        ObjFunction* func = (ObjFunction*)t;
-        chunk_destroy(&func->chunk);
-        FREE(ObjFunction, func);
+        MEM_FREE(char, str->chars, str->length + 1);
         break;
 
-    case OBJ_NATIVE:
-        FREE(ObjNative, t);
+    case OBJ_FUNCTION:
+        chunk_destroy(&((ObjFunction*)t)->chunk);
+        chunk_destroy(&((ObjFunction*)t)->reg_chunk);
         break;
 
     case OBJ_CLOSURE:
         ObjClosure* closure = (ObjClosure*)t;
-        //free_upvalues(closure);
-        free(closure->upvalues);
-        FREE(ObjClosure, t);
+        MEM_FREE(ObjUpvalue*, closure->upvalues, closure->upvalues_count);
         break;
 
+    case OBJ_NATIVE:
     case OBJ_UPVALUE:
-        FREE(ObjUpvalue, t);
-        break;
-
+    case OBJ_ROPE:
     default:
         break;
     }
 };
 
+void freeObj(Obj* t) {
+    #ifdef DEBUG_LOG_GC
+    printf("%p free type %d\n", (void*)t, t->type);
+    #endif
+
+    freeObj_fields(t);
+    realloc_ptr(t, obj_size(t->type), 0);
+};
+
 #define ALLOCATE_OBJ(type, objType)  \
-    allocate_obj(sizeof(type), objType)
+    (type*)allocate_obj(sizeof(type), objType)
 
 
 ObjFunction* new_function() {
+    // chunk buffers first: allocating them may run gc,
+    // and function object must be complete by then.
+    Chunk chunk;
+    chunk_init(&chunk, 24);
+
     ObjFunction* f = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     f->arity = 0;
     f->name = NULL;
     f->upvalue_count = 0;
-    chunk_init(&f->chunk, 24);
+    f->max_slots = 0;
+    f->chunk = chunk;
+    memset(&f->reg_chunk, 0, sizeof(Chunk));
+    f->reg_count = 0;
     return f;
 };
 
@@ -79,26 +101,68 @@ ObjString* allocate_string(char* chars, int length, uint32_t hash) {
     s->chars = chars;
 
     // vm string collect
+    // keep it on stack: table growth may run gc.
+    vm_stack_push(OBJ_VAL(s));
     hashtable_set(&vm.strings, s, NULL_VAL);
+    vm_stack_pop();
 
     return s;
 };
 
+#define HASH_MUL 0x9E3779B97F4A7C15ULL
+
+// murmur3 finalizer: every input bit reaches the low bits tables index by.
+static inline uint64_t hash_finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+};
+
+static inline uint64_t hash_word(uint64_t h, uint64_t word) {
+    // multiply carries bits up only, the shift brings them back down.
+    h = (h ^ word) * HASH_MUL;
+    return h ^ (h >> 32);
+};
+
+// word at a time: one multiply per 8 bytes. Tail of 1..7 bytes is
+// read by fixed size loads, overlapping ones for 4..7 (length is in
+// the seed, so that is no ambiguity).
 uint32_t hash_string(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 167777619;
+    uint64_t h = hash_word(0x2D358DCCAA6C78A5ULL, (uint64_t)length);
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, key + i, 8);
+        h = hash_word(h, word);
     }
 
-    return hash;
+    int rest = length - i;
+    const uint8_t* tail = (const uint8_t*)key + i;
+    if (rest >= 4) {
+        uint32_t low, high;
+        memcpy(&low, tail, 4);
+        memcpy(&high, tail + rest - 4, 4);
+        h = hash_word(h, ((uint64_t)high << 32) | low);
+    } else if (rest > 0) {
+        h = hash_word(h, ((uint64_t)tail[0] << 16) | ((uint64_t)tail[rest >> 1] << 8) | tail[rest - 1]);
+    }
+
+    h = hash_finish(h);
+    return (uint32_t)(h ^ (h >> 32));
 };
 
-ObjString* new_string(const char* chars, int length) {
+// takes ownership of heap allocated chars.
+ObjString* new_string(char* chars, int length) {
     uint32_t hash = hash_string(chars, length);
 
     ObjString* intern_str = hashtable_find_string(&vm.strings, chars, length, hash);
-    if (intern_str != NULL) return intern_str;
+    if (intern_str != NULL) {
+        MEM_FREE(char, chars, length + 1);
+        return intern_str;
+    }
 
     return allocate_string(chars, length, hash);
 };
@@ -116,6 +180,73 @@ ObjString* copy_string(const char* chars, int length) {
     return allocate_string(heapChars, length, hash);
 };
 
+// children must be reachable by gc until the rope is.
+ObjRope* new_rope(Obj* left, Obj* right, int length) {
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = length;
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    GC_WRITE_BARRIER(rope, OBJ_VAL(left));
+    GC_WRITE_BARRIER(rope, OBJ_VAL(right));
+    return rope;
+};
+
+// iterative: a rope built in a loop is as deep as the loop is long.
+void rope_each(ObjRope* rope, RopeVisitor visit, void* context) {
+    Obj** pending = NULL;
+    int count = 0;
+    int capacity = 0;
+    Obj* node = (Obj*)rope;
+
+    for (;;) {
+        if (node->type == OBJ_STRING) {
+            ObjString* str = (ObjString*)node;
+            visit(str->chars, str->length, context);
+        } else if (((ObjRope*)node)->flat != NULL) {
+            ObjString* flat = ((ObjRope*)node)->flat;
+            visit(flat->chars, flat->length, context);
+        } else {
+            // plain malloc, as gc gray stack: no collection mid-walk.
+            if (capacity < count + 1) {
+                capacity = GROW_CAPACITY(capacity);
+                pending = (Obj**)realloc(pending, sizeof(Obj*) * capacity);
+                if (pending == NULL) exit(1);
+            }
+            pending[count++] = ((ObjRope*)node)->right;
+            node = ((ObjRope*)node)->left;
+            continue;
+        }
+
+        if (count == 0) break;
+        node = pending[--count];
+    }
+
+    free(pending);
+};
+
+static void rope_copy(const char* chars, int length, void* context) {
+    char** dest = (char**)context;
+    memcpy(*dest, chars, length);
+    *dest += length;
+};
+
+ObjString* rope_flatten(ObjRope* rope) {
+    if (rope->flat != NULL) return rope->flat;
+
+    char* chars = ALLOCATE(char, rope->length + 1);
+    char* dest = chars;
+    rope_each(rope, rope_copy, &dest);
+    chars[rope->length] = '\0';
+
+    rope->flat = new_string(chars, rope->length);
+    GC_WRITE_BARRIER(rope, OBJ_VAL(rope->flat));
+    // children are garbage now unless shared.
+    rope->left = NULL;
+    rope->right = NULL;
+    return rope->flat;
+};
+
 ObjNative* new_native(NativeFn function) {
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
@@ -123,17 +254,19 @@ ObjNative* new_native(NativeFn function) {
 };
 
 ObjClosure* new_closure(ObjFunction* function) {
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
-    
+    // upvalues array first: closure must be complete if gc runs.
     int upvalues_count = function->upvalue_count;
     ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, upvalues_count);
     for (int i = 0; i < upvalues_count; i++) {
         upvalues[i] = NULL;
     }
 
+    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+
     closure->function = function;
     closure->upvalues = upvalues;
     closure->upvalues_count = upvalues_count;
+    GC_WRITE_BARRIER(closure, OBJ_VAL(function));
     
     return closure;
 };
@@ -11,11 +11,16 @@ typedef enum ObjType {
     OBJ_FUNCTION,
     OBJ_NATIVE,
     OBJ_CLOSURE,
-    OBJ_UPVALUE
+    OBJ_UPVALUE,
+    OBJ_ROPE
 } ObjType;
 
 struct Obj {
     ObjType type;
+    bool is_marked;
+    bool is_young; // lives in nursery
+    bool is_remembered; // old object in remembered set
+    // old: vm.objects list link, young: forwarding pointer once promoted.
     struct Obj* next;
 };
 
@@ -32,6 +37,11 @@ typedef struct {
     Chunk chunk;
     ObjString* name;
     int upvalue_count;
+    // stack slots frame needs: callee, args, locals, temporaries.
+    int max_slots;
+    // register backend: code uses chunk.constants.
+    Chunk reg_chunk;
+    int reg_count;
 } ObjFunction; 
 
 typedef Value(*NativeFn)(int argCount, Value* args, bool* success);
@@ -55,22 +65,56 @@ typedef struct {
     NativeFn function;
 } ObjNative;
 
+/*
+    Lazy concatenation result: left + right, each an ObjString or ObjRope.
+    `+` builds ropes instead of copying, so building a string in a loop
+    is linear. Flattened into an interned string on first compare;
+    `flat` then replaces the children. Ropes are never table keys.
+*/
+typedef struct {
+    Obj obj;
+    int length;
+    Obj* left;
+    Obj* right;
+    ObjString* flat; // NULL until flattened
+} ObjRope;
+
+// shorter concatenations are copied into a flat string right away.
+#define ROPE_MIN_LENGTH 32
+
+typedef void (*RopeVisitor)(const char* chars, int length, void* context);
+
 ObjFunction* new_function();
 ObjNative* new_native(NativeFn function);
 ObjClosure* new_closure(ObjFunction* function);
 ObjUpvalue* new_upvalue(Value* slot);
 
+uint32_t hash_string(const char* key, int length);
 ObjString* copy_string(const char* chars, int length);
-ObjString* new_string(const char* chars, int length);
-bool is_obj_type(Value v, ObjType type);
+ObjString* new_string(char* chars, int length);
+
+ObjRope* new_rope(Obj* left, Obj* right, int length);
+// chars of the rope left to right, no vm allocation.
+void rope_each(ObjRope* rope, RopeVisitor visit, void* context);
+// caller keeps the rope reachable: interning may run gc.
+ObjString* rope_flatten(ObjRope* rope);
+
+static inline bool is_obj_type(Value v, ObjType type) {
+    return IS_OBJ(v) && AS_OBJ(v)->type == type;
+};
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 #define IS_STRING(value) (is_obj_type(value, OBJ_STRING))
+#define IS_ROPE(value) (is_obj_type(value, OBJ_ROPE))
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value))
 
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
 
+size_t obj_size(ObjType type);
 void freeObj(Obj* t);
+void freeObj_fields(Obj* t);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,426 @@
+#include "optimizer.h"
+#include "vm.h"
+#include "object.h"
+#include "string.h"
+#include "math.h"
+
+typedef struct {
+    int old_offset; // first byte of source code it was made from
+    int new_offset;
+} OptInstr;
+
+typedef struct {
+    int instr; // index in instrs
+    int length; // offset is the last operand, counted from the end
+    int old_target;
+} OptJump;
+
+typedef struct {
+    Chunk* chunk;
+    bool* is_target; // by old offset
+
+    // rewritten code
+    uint8_t* code;
+    int* lines;
+    int count;
+
+    OptInstr* instrs;
+    int instr_count;
+
+    OptJump* jumps;
+    int jump_count;
+} Optimizer;
+
+static int jump_target(Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+
+    if (chunk->code[offset] == OP_LOOP) return offset + 3 - jump;
+    return offset + 3 + jump;
+};
+
+static bool is_jump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE ||
+        op == OP_JUMP_IF_TRUE || op == OP_LOOP;
+};
+
+// nobody jumps into (from, to].
+static bool no_targets(Optimizer* t, int from, int to) {
+    for (int i = from + 1; i <= to; i++) {
+        if (t->is_target[i]) return false;
+    }
+
+    return true;
+};
+
+static void begin_instr(Optimizer* t, int old_offset) {
+    t->instrs[t->instr_count].old_offset = old_offset;
+    t->instrs[t->instr_count].new_offset = t->count;
+    t->instr_count++;
+};
+
+static void emit(Optimizer* t, uint8_t byte, int line) {
+    t->lines[t->count] = line;
+    t->code[t->count++] = byte;
+};
+
+// drop rewritten instructions from index on.
+static void drop_instrs(Optimizer* t, int index) {
+    t->count = t->instrs[index].new_offset;
+    t->instr_count = index;
+};
+
+// value of constant instruction, objects are left alone.
+static bool instr_value(Optimizer* t, int index, Value* out) {
+    uint8_t* code = &t->code[t->instrs[index].new_offset];
+    switch (*code)
+    {
+    case OP_NULL: *out = NULL_VAL; return true;
+    case OP_TRUE: *out = BOOL_VAl(true); return true;
+    case OP_FALSE: *out = BOOL_VAl(false); return true;
+    case OP_CONST:
+        *out = t->chunk->constants.values[code[1]];
+        return IS_NUMBER(*out);
+
+    default:
+        return false;
+    }
+};
+
+static int number_constant(Chunk* chunk, double number) {
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value v = chunk->constants.values[i];
+        if (IS_NUMBER(v) && AS_NUMBER(v) == number &&
+            signbit(AS_NUMBER(v)) == signbit(number)) {
+            return i;
+        }
+    }
+
+    if (chunk->constants.count > UINT8_MAX) return -1;
+    return chunk_add_constant(chunk, NUMBER_VAL(number));
+};
+
+// replace instructions [index, end) with one that loads value.
+static bool replace_with_value(Optimizer* t, int index, Value value) {
+    int constant = 0;
+    if (IS_NUMBER(value)) {
+        constant = number_constant(t->chunk, AS_NUMBER(value));
+        if (constant < 0) return false;
+    }
+
+    int old_offset = t->instrs[index].old_offset;
+    int line = t->lines[t->instrs[index].new_offset];
+    drop_instrs(t, index);
+    begin_instr(t, old_offset);
+
+    if (IS_BOOL(value)) {
+        emit(t, AS_BOOL(value) ? OP_TRUE : OP_FALSE, line);
+    } else if (IS_NULL(value)) {
+        emit(t, OP_NULL, line);
+    } else {
+        emit(t, OP_CONST, line);
+        emit(t, (uint8_t)constant, line);
+    }
+
+    return true;
+};
+
+static bool fold_unary(Optimizer* t, uint8_t op, int offset) {
+    if (t->instr_count < 1) return false;
+
+    int a = t->instr_count - 1;
+    Value value;
+    if (!instr_value(t, a, &value)) return false;
+    if (!no_targets(t, t->instrs[a].old_offset, offset)) return false;
+
+    switch (op)
+    {
+    case OP_NEGATE:
+        if (!IS_NUMBER(value)) return false;
+        return replace_with_value(t, a, NUMBER_VAL(-AS_NUMBER(value)));
+
+    case OP_NOT:
+        return replace_with_value(t, a, BOOL_VAl(bool_is_falsey(value)));
+
+    default:
+        return false;
+    }
+};
+
+static bool fold_binary(Optimizer* t, uint8_t op, int offset) {
+    if (t->instr_count < 2) return false;
+
+    int a = t->instr_count - 2;
+    Value lhs, rhs;
+    if (!instr_value(t, a, &lhs) || !instr_value(t, a + 1, &rhs)) return false;
+    if (!no_targets(t, t->instrs[a].old_offset, offset)) return false;
+
+    if (op == OP_EQUAL) {
+        return replace_with_value(t, a, BOOL_VAl(valuesEqual(lhs, rhs)));
+    }
+
+    // runtime errors and string concat are left to the vm.
+    if (!IS_NUMBER(lhs) || !IS_NUMBER(rhs)) return false;
+    double x = AS_NUMBER(lhs);
+    double y = AS_NUMBER(rhs);
+
+    switch (op)
+    {
+    case OP_ADD: return replace_with_value(t, a, NUMBER_VAL(x + y));
+    case OP_SUB: return replace_with_value(t, a, NUMBER_VAL(x - y));
+    case OP_MUL: return replace_with_value(t, a, NUMBER_VAL(x * y));
+    case OP_DIV: return replace_with_value(t, a, NUMBER_VAL(x / y));
+    case OP_LESS: return replace_with_value(t, a, BOOL_VAl(x < y));
+    case OP_GREATER: return replace_with_value(t, a, BOOL_VAl(x > y));
+
+    default:
+        return false;
+    }
+};
+
+static void add_jump(Optimizer* t, int length, int old_target) {
+    t->jumps[t->jump_count].instr = t->instr_count - 1;
+    t->jumps[t->jump_count].length = length;
+    t->jumps[t->jump_count].old_target = old_target;
+    t->jump_count++;
+};
+
+// rewritten instruction right before offset is a plain NOT.
+static bool is_not_before(Optimizer* t, int index, int offset) {
+    return index >= 0 && t->instrs[index].old_offset == offset - 1 &&
+        t->code[t->instrs[index].new_offset] == OP_NOT &&
+        !t->is_target[offset];
+};
+
+// NOT, JUMP_IF_FALSE -> JUMP_IF_TRUE, NOT, NOT, JUMP_IF_FALSE -> JUMP_IF_FALSE.
+// the condition left on stack is not negated anymore, so both
+// branches have to pop it before anybody can see it.
+static bool fuse_not_jump(Optimizer* t, int offset) {
+    int a = t->instr_count - 1;
+    if (!is_not_before(t, a, offset)) return false;
+
+    Chunk* chunk = t->chunk;
+    int target = jump_target(chunk, offset);
+    if (chunk->code[offset + 3] != OP_POP) return false;
+    if (target >= chunk->count || chunk->code[target] != OP_POP) return false;
+
+    uint8_t op = OP_JUMP_IF_TRUE;
+    if (is_not_before(t, a - 1, offset - 1)) {
+        op = OP_JUMP_IF_FALSE;
+        a--;
+    }
+
+    int old_offset = t->instrs[a].old_offset;
+    int line = chunk->lines[offset];
+    drop_instrs(t, a);
+    begin_instr(t, old_offset);
+    emit(t, op, line);
+    emit(t, 0xff, line);
+    emit(t, 0xff, line);
+    add_jump(t, 3, target);
+    return true;
+};
+
+// rewritten instruction index is op, made from code at old offset.
+static bool is_instr(Optimizer* t, int index, uint8_t op, int old_offset) {
+    return index >= 0 && t->instrs[index].old_offset == old_offset &&
+        t->code[t->instrs[index].new_offset] == op;
+};
+
+static bool is_number_const(Optimizer* t, int index) {
+    Value value;
+    return t->code[t->instrs[index].new_offset] == OP_CONST &&
+        instr_value(t, index, &value) && IS_NUMBER(value);
+};
+
+// GET_LOCAL, CONST, ADD -> ADD_LOCAL_CONST.
+static bool fuse_add_local_const(Optimizer* t, int offset) {
+    int a = t->instr_count - 2;
+    if (!is_instr(t, a, OP_GET_LOCAL, offset - 4)) return false;
+    if (!is_instr(t, a + 1, OP_CONST, offset - 2)) return false;
+    if (!is_number_const(t, a + 1)) return false;
+    if (!no_targets(t, offset - 4, offset)) return false;
+
+    uint8_t slot = t->code[t->instrs[a].new_offset + 1];
+    uint8_t constant = t->code[t->instrs[a + 1].new_offset + 1];
+    int line = t->chunk->lines[offset];
+    drop_instrs(t, a);
+    begin_instr(t, offset - 4);
+    emit(t, OP_ADD_LOCAL_CONST, line);
+    emit(t, slot, line);
+    emit(t, constant, line);
+    return true;
+};
+
+// SET_LOCAL, POP -> SET_LOCAL_POP.
+static bool fuse_set_local_pop(Optimizer* t, int offset) {
+    int a = t->instr_count - 1;
+    if (!is_instr(t, a, OP_SET_LOCAL, offset - 2)) return false;
+    if (t->is_target[offset]) return false;
+
+    uint8_t slot = t->code[t->instrs[a].new_offset + 1];
+    int line = t->lines[t->instrs[a].new_offset];
+    drop_instrs(t, a);
+    begin_instr(t, offset - 2);
+    emit(t, OP_SET_LOCAL_POP, line);
+    emit(t, slot, line);
+    return true;
+};
+
+// GET_LOCAL, GET_LOCAL|CONST, LESS, JUMP_IF_FALSE, POP ->
+// LESS_LOCALS|LESS_LOCAL_CONST_JUMP_IF_FALSE, jumps past the POP at target.
+// returns bytes of source code taken, 0 if not fused.
+static int fuse_less_jump(Optimizer* t, int offset) {
+    int a = t->instr_count - 3;
+    if (!is_instr(t, a, OP_GET_LOCAL, offset - 5)) return 0;
+    if (!is_instr(t, a + 2, OP_LESS, offset - 1)) return 0;
+
+    uint8_t op;
+    if (is_instr(t, a + 1, OP_GET_LOCAL, offset - 3)) {
+        op = OP_LESS_LOCALS_JUMP_IF_FALSE;
+    } else if (is_instr(t, a + 1, OP_CONST, offset - 3) && is_number_const(t, a + 1)) {
+        op = OP_LESS_LOCAL_CONST_JUMP_IF_FALSE;
+    } else {
+        return 0;
+    }
+
+    Chunk* chunk = t->chunk;
+    int target = jump_target(chunk, offset);
+    if (chunk->code[offset + 3] != OP_POP) return 0;
+    if (target >= chunk->count || chunk->code[target] != OP_POP) return 0;
+    if (!no_targets(t, offset - 5, offset + 3)) return 0;
+
+    uint8_t x = t->code[t->instrs[a].new_offset + 1];
+    uint8_t y = t->code[t->instrs[a + 1].new_offset + 1];
+    int line = chunk->lines[offset];
+    drop_instrs(t, a);
+    begin_instr(t, offset - 5);
+    emit(t, op, line);
+    emit(t, x, line);
+    emit(t, y, line);
+    emit(t, 0xff, line);
+    emit(t, 0xff, line);
+    add_jump(t, 5, target + 1);
+    return 4;
+};
+
+// returns bytes of source code taken, 0 if instruction is left as is.
+static int rewrite_instr(Optimizer* t, int offset, int length) {
+    uint8_t op = t->chunk->code[offset];
+    switch (op)
+    {
+    case OP_NEGATE:
+    case OP_NOT:
+        return fold_unary(t, op, offset) ? length : 0;
+
+    case OP_ADD:
+        if (fold_binary(t, op, offset)) return length;
+        return fuse_add_local_const(t, offset) ? length : 0;
+
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_EQUAL:
+        return fold_binary(t, op, offset) ? length : 0;
+
+    case OP_JUMP_IF_FALSE:
+        if (fuse_not_jump(t, offset)) return length;
+        return fuse_less_jump(t, offset);
+
+    case OP_POP:
+        return fuse_set_local_pop(t, offset) ? length : 0;
+
+    default:
+        return 0;
+    }
+};
+
+static void copy_instr(Optimizer* t, int offset, int length) {
+    Chunk* chunk = t->chunk;
+    begin_instr(t, offset);
+    for (int i = 0; i < length; i++) {
+        emit(t, chunk->code[offset + i], chunk->lines[offset + i]);
+    }
+
+    if (is_jump(chunk->code[offset])) {
+        add_jump(t, 3, jump_target(chunk, offset));
+    }
+};
+
+static void patch_jumps(Optimizer* t) {
+    Chunk* chunk = t->chunk;
+
+    // old offset -> new offset, folded code maps on its result.
+    int* map = ALLOCATE(int, chunk->count + 1);
+    for (int i = 0; i < t->instr_count; i++) {
+        int end = i + 1 < t->instr_count ? t->instrs[i + 1].old_offset : chunk->count;
+        for (int o = t->instrs[i].old_offset; o < end; o++) {
+            map[o] = t->instrs[i].new_offset;
+        }
+    }
+    map[chunk->count] = t->count;
+
+    for (int i = 0; i < t->jump_count; i++) {
+        int at = t->instrs[t->jumps[i].instr].new_offset;
+        int end = at + t->jumps[i].length;
+        int target = map[t->jumps[i].old_target];
+        int jump = t->code[at] == OP_LOOP ? end - target : target - end;
+
+        t->code[end - 2] = (jump >> 8) & 0xff;
+        t->code[end - 1] = jump & 0xff;
+    }
+
+    MEM_FREE(int, map, chunk->count + 1);
+};
+
+void optimize_chunk(Chunk* chunk) {
+    Optimizer t;
+    int count = chunk->count;
+
+    // rewriting only shrinks code, old size bounds everything.
+    t.chunk = chunk;
+    t.is_target = ALLOCATE(bool, count + 1);
+    t.code = ALLOCATE(uint8_t, count);
+    t.lines = ALLOCATE(int, count);
+    t.instrs = ALLOCATE(OptInstr, count);
+    t.jumps = ALLOCATE(OptJump, count);
+    t.count = 0;
+    t.instr_count = 0;
+    t.jump_count = 0;
+
+    memset(t.is_target, 0, sizeof(bool) * (count + 1));
+    for (int offset = 0; offset < count; offset += chunk_instruction_length(chunk, offset)) {
+        if (is_jump(chunk->code[offset])) {
+            int target = jump_target(chunk, offset);
+            t.is_target[target] = true;
+            // fused conditional jumps land past the POP.
+            if (target < count && chunk->code[target] == OP_POP) {
+                t.is_target[target + 1] = true;
+            }
+        }
+    }
+
+    for (int offset = 0; offset < count;) {
+        int length = chunk_instruction_length(chunk, offset);
+        int taken = rewrite_instr(&t, offset, length);
+        if (taken == 0) {
+            copy_instr(&t, offset, length);
+            taken = length;
+        }
+        offset += taken;
+    }
+
+    patch_jumps(&t);
+
+    memcpy(chunk->code, t.code, t.count);
+    memcpy(chunk->lines, t.lines, sizeof(int) * t.count);
+    chunk->count = t.count;
+
+    MEM_FREE(bool, t.is_target, count + 1);
+    MEM_FREE(uint8_t, t.code, count);
+    MEM_FREE(int, t.lines, count);
+    MEM_FREE(OptInstr, t.instrs, count);
+    MEM_FREE(OptJump, t.jumps, count);
+};
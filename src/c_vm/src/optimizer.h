@@ -0,0 +1,25 @@
+#ifndef CVM_OPTIMIZER_H
+#define CVM_OPTIMIZER_H
+
+#include "common.h"
+#include "chunk.h"
+
+/*
+    Peephole pass, runs over a finished chunk (end_compiler).
+
+    - constant folding: CONST a, CONST b, ADD -> CONST (a+b),
+      same for SUB MUL DIV LESS GREATER EQUAL NEGATE NOT
+      on numbers and true/false/null literals.
+    - NOT, JUMP_IF_FALSE -> JUMP_IF_TRUE (and NOT, NOT dropped) when
+      both branches pop the condition right away (if, while, for).
+    - superinstructions for loop code (see chunk.h): ADD_LOCAL_CONST,
+      SET_LOCAL_POP, LESS_LOCALS / LESS_LOCAL_CONST_JUMP_IF_FALSE.
+
+    Code never crosses a jump target while folding, jump offsets
+    are fixed up once the chunk is rewritten.
+    Enabled by COMPILER_OPTIMIZE (Makefile: OPTIMIZE=1).
+*/
+
+void optimize_chunk(Chunk* chunk);
+
+#endif
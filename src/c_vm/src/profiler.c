@@ -0,0 +1,186 @@
+#include "profiler.h"
+#include "vm.h"
+#include "object.h"
+#include "stdlib.h"
+#include "string.h"
+#include "sys/time.h"
+
+#define PROFILER_TABLE_MIN 256
+#define PROFILER_MAX_LOAD 0.75
+
+volatile sig_atomic_t profiler_pending = 0;
+
+// unique stacks with sample counts, plain malloc: no gc while sampling.
+typedef struct {
+    char* stack; // NULL - empty entry
+    uint64_t hash;
+    uint64_t count;
+} StackEntry;
+
+static struct {
+    bool running;
+    const char* path;
+    StackEntry* entries;
+    int count;
+    int capacity;
+    // current sample text
+    char* buffer;
+    size_t buffer_capacity;
+} profiler;
+
+static void on_tick(int signal) {
+    (void)signal;
+    profiler_pending = 1;
+};
+
+static void set_timer(long interval_us) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+};
+
+bool profiler_start(const char* path) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+    profiler.running = true;
+    profiler.path = path;
+    atexit(profiler_stop);
+    set_timer(PROFILER_INTERVAL_US);
+    return true;
+};
+
+// FNV-1a, 64 bit.
+static uint64_t hash_stack(const char* stack, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)stack[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+};
+
+static StackEntry* find_entry(StackEntry* entries, int capacity,
+                              const char* stack, uint64_t hash) {
+    int index = (int)(hash & (uint64_t)(capacity - 1));
+    for (;;) {
+        StackEntry* entry = &entries[index];
+        if (entry->stack == NULL ||
+            (entry->hash == hash && strcmp(entry->stack, stack) == 0)) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+};
+
+static bool grow_table() {
+    int capacity = profiler.capacity < PROFILER_TABLE_MIN
+        ? PROFILER_TABLE_MIN
+        : profiler.capacity * 2;
+    StackEntry* entries = (StackEntry*)calloc(capacity, sizeof(StackEntry));
+    if (entries == NULL) return false;
+
+    for (int i = 0; i < profiler.capacity; i++) {
+        StackEntry* old = &profiler.entries[i];
+        if (old->stack == NULL) continue;
+        *find_entry(entries, capacity, old->stack, old->hash) = *old;
+    }
+
+    free(profiler.entries);
+    profiler.entries = entries;
+    profiler.capacity = capacity;
+    return true;
+};
+
+static bool append(size_t* length, const char* text, size_t text_length) {
+    if (*length + text_length + 1 > profiler.buffer_capacity) {
+        size_t capacity = profiler.buffer_capacity < 256 ? 256 : profiler.buffer_capacity;
+        while (capacity < *length + text_length + 1) capacity *= 2;
+
+        char* grown = (char*)realloc(profiler.buffer, capacity);
+        if (grown == NULL) return false;
+        profiler.buffer = grown;
+        profiler.buffer_capacity = capacity;
+    }
+
+    memcpy(profiler.buffer + *length, text, text_length);
+    *length += text_length;
+    profiler.buffer[*length] = '\0';
+    return true;
+};
+
+void profiler_sample() {
+    profiler_pending = 0;
+    if (!profiler.running || vm.frames_count == 0) return;
+
+    // root first: frames[0] is the script.
+    size_t length = 0;
+    for (int i = 0; i < vm.frames_count; i++) {
+        CallFrame* frame = &vm.frames[i];
+        ObjFunction* func = get_frame_function(frame);
+        Chunk* chunk = vm.backend == BACKEND_REGISTER ? &func->reg_chunk : &func->chunk;
+        int instr = (int)(frame->ip - chunk->code) - 1;
+        int line = instr >= 0 && instr < chunk->count ? chunk->lines[instr] : 0;
+
+        const char* name = func->name != NULL ? func->name->chars : "<script>";
+        char location[32];
+        int location_length = snprintf(location, sizeof(location), ":%d", line);
+        if ((i > 0 && !append(&length, ";", 1)) ||
+            !append(&length, name, strlen(name)) ||
+            !append(&length, location, location_length)) {
+            return;
+        }
+    }
+
+    if (profiler.count + 1 > profiler.capacity * PROFILER_MAX_LOAD && !grow_table()) {
+        return;
+    }
+
+    uint64_t hash = hash_stack(profiler.buffer, length);
+    StackEntry* entry = find_entry(profiler.entries, profiler.capacity, profiler.buffer, hash);
+    if (entry->stack == NULL) {
+        entry->stack = (char*)malloc(length + 1);
+        if (entry->stack == NULL) return;
+        memcpy(entry->stack, profiler.buffer, length + 1);
+        entry->hash = hash;
+        profiler.count++;
+    }
+    entry->count++;
+};
+
+void profiler_stop() {
+    if (!profiler.running) return;
+    profiler.running = false;
+    set_timer(0);
+
+    FILE* f = fopen(profiler.path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "profiler: can't write '%s'.\n", profiler.path);
+    }
+
+    for (int i = 0; i < profiler.capacity; i++) {
+        StackEntry* entry = &profiler.entries[i];
+        if (entry->stack == NULL) continue;
+        if (f != NULL) {
+            fprintf(f, "%s %llu\n", entry->stack, (unsigned long long)entry->count);
+        }
+        free(entry->stack);
+    }
+
+    if (f != NULL) fclose(f);
+    free(profiler.entries);
+    free(profiler.buffer);
+    profiler.entries = NULL;
+    profiler.buffer = NULL;
+    profiler.count = 0;
+    profiler.capacity = 0;
+    profiler.buffer_capacity = 0;
+};
@@ -0,0 +1,42 @@
+#ifndef CVM_PROFILER_H
+#define CVM_PROFILER_H
+
+#include "common.h"
+#include "signal.h"
+
+/*
+    Sampling profiler (main: --profile <file>).
+
+    SIGPROF timer fires every PROFILER_INTERVAL_US of cpu time and only
+    sets profiler_pending. The vm takes the sample at its next safepoint
+    (loop back edge, call), where frame ips are up to date, so the
+    interpreter loop pays one flag check per loop iteration / call.
+    Sample is the vm.frames chain, `function:line` per frame.
+
+    At exit samples are written as folded stacks, one unique stack per line
+    (flamegraph.pl, speedscope, inferno):
+        <script>:12;fib:3;fib:4 117
+*/
+
+#define PROFILER_INTERVAL_US 1000
+
+extern volatile sig_atomic_t profiler_pending;
+
+// start timer, samples go to `path` at exit. false if timer can't be set.
+bool profiler_start(const char* path);
+
+// record current vm.frames chain.
+void profiler_sample();
+
+// stop timer and write folded stacks, called at exit.
+void profiler_stop();
+
+#define PROFILER_SAFEPOINT(frame, ip) \
+    do { \
+        if (profiler_pending) { \
+            (frame)->ip = (ip); \
+            profiler_sample(); \
+        } \
+    } while (false)
+
+#endif
@@ -0,0 +1,449 @@
+#include "regvm.h"
+#include "object.h"
+#include "string.h"
+
+// where a stack value is until it gets its own register.
+typedef enum {
+    SYM_REG, // in register index (its own slot or a local)
+    SYM_CONST, // constant index, not loaded yet
+} SymKind;
+
+typedef struct {
+    SymKind kind;
+    int index;
+} Sym;
+
+typedef struct {
+    int at; // offset in reg code
+    int length;
+    int old_target;
+} RegJump;
+
+typedef struct {
+    ObjFunction* function;
+    Chunk* in;
+    Chunk* out;
+    int line;
+    bool failed;
+
+    Sym stack[UINT8_MAX + 1];
+    int depth;
+    int max_depth;
+
+    bool* is_target; // by stack code offset
+    int* depth_at; // stack depth before instruction, -1 if unreachable
+    int* map; // stack code offset -> reg code offset
+
+    RegJump* jumps;
+    int jump_count;
+} RegCompiler;
+
+static void emit(RegCompiler* t, uint8_t byte) {
+    chunk_write(t->out, byte, t->line);
+};
+
+static void emit_short(RegCompiler* t, uint16_t operand) {
+    emit(t, (operand >> 8) & 0xff);
+    emit(t, operand & 0xff);
+};
+
+static bool is_home(RegCompiler* t, int slot) {
+    return t->stack[slot].kind == SYM_REG && t->stack[slot].index == slot;
+};
+
+static uint8_t rk(RegCompiler* t, Sym sym) {
+    if (sym.index > REG_RK_MAX) {
+        t->failed = true;
+        return 0;
+    }
+
+    return sym.kind == SYM_CONST ? (uint8_t)(sym.index | REG_RK_CONST) : (uint8_t)sym.index;
+};
+
+static uint8_t reg(RegCompiler* t, int slot) {
+    if (slot > UINT8_MAX) {
+        t->failed = true;
+        return 0;
+    }
+
+    return (uint8_t)slot;
+};
+
+static void push(RegCompiler* t, SymKind kind, int index) {
+    if (t->depth > UINT8_MAX) {
+        t->failed = true;
+        return;
+    }
+
+    t->stack[t->depth].kind = kind;
+    t->stack[t->depth].index = index;
+    t->depth++;
+    if (t->depth > t->max_depth) t->max_depth = t->depth;
+};
+
+// value pushed straight into its own register.
+static int push_home(RegCompiler* t) {
+    int slot = t->depth;
+    push(t, SYM_REG, slot);
+    return slot;
+};
+
+static Sym top(RegCompiler* t) {
+    return t->stack[t->depth - 1];
+};
+
+static void materialize(RegCompiler* t, int slot) {
+    if (is_home(t, slot)) return;
+
+    emit(t, REG_MOVE);
+    emit(t, reg(t, slot));
+    emit(t, rk(t, t->stack[slot]));
+    t->stack[slot].kind = SYM_REG;
+    t->stack[slot].index = slot;
+};
+
+// control flow joins and calls see every value in its own register.
+static void materialize_all(RegCompiler* t) {
+    for (int i = 0; i < t->depth; i++) {
+        materialize(t, i);
+    }
+};
+
+// register is about to change, pending reads of it go first.
+static void materialize_refs(RegCompiler* t, int slot) {
+    for (int i = slot + 1; i < t->depth; i++) {
+        if (t->stack[i].kind == SYM_REG && t->stack[i].index == slot) {
+            materialize(t, i);
+        }
+    }
+};
+
+static void add_jump(RegCompiler* t, int at, int length, int old_target) {
+    t->jumps[t->jump_count].at = at;
+    t->jumps[t->jump_count].length = length;
+    t->jumps[t->jump_count].old_target = old_target;
+    t->jump_count++;
+};
+
+static int jump_target(Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+
+    if (chunk->code[offset] == OP_LOOP) return offset + 3 - jump;
+    return offset + 3 + jump;
+};
+
+static void emit_jump(RegCompiler* t, uint8_t op, int offset) {
+    materialize_all(t);
+
+    int at = t->out->count;
+    emit(t, op);
+    if (op == REG_JUMP_IF_FALSE) emit(t, reg(t, t->depth - 1));
+    emit_short(t, 0xffff);
+
+    add_jump(t, at, t->out->count - at, jump_target(t->in, offset));
+};
+
+static void emit_binary(RegCompiler* t, uint8_t op) {
+    Sym b = t->stack[t->depth - 1];
+    Sym a = t->stack[t->depth - 2];
+    t->depth -= 2;
+    int slot = push_home(t);
+
+    emit(t, op);
+    emit(t, reg(t, slot));
+    emit(t, rk(t, a));
+    emit(t, rk(t, b));
+};
+
+static void emit_unary(RegCompiler* t, uint8_t op) {
+    Sym a = top(t);
+    t->depth--;
+    int slot = push_home(t);
+
+    emit(t, op);
+    emit(t, reg(t, slot));
+    emit(t, rk(t, a));
+};
+
+static void translate(RegCompiler* t, int offset) {
+    Chunk* in = t->in;
+    uint8_t* code = &in->code[offset];
+
+    switch (code[0])
+    {
+    case OP_CONST:
+        if (code[1] <= REG_RK_MAX) {
+            push(t, SYM_CONST, code[1]);
+        } else {
+            emit(t, REG_LOADK);
+            emit(t, reg(t, push_home(t)));
+            emit(t, code[1]);
+        }
+        break;
+
+    case OP_NULL: emit(t, REG_NULL); emit(t, reg(t, push_home(t))); break;
+    case OP_TRUE: emit(t, REG_TRUE); emit(t, reg(t, push_home(t))); break;
+    case OP_FALSE: emit(t, REG_FALSE); emit(t, reg(t, push_home(t))); break;
+
+    case OP_NEGATE: emit_unary(t, REG_NEGATE); break;
+    case OP_NOT: emit_unary(t, REG_NOT); break;
+
+    case OP_ADD: emit_binary(t, REG_ADD); break;
+    case OP_SUB: emit_binary(t, REG_SUB); break;
+    case OP_MUL: emit_binary(t, REG_MUL); break;
+    case OP_DIV: emit_binary(t, REG_DIV); break;
+    case OP_EQUAL: emit_binary(t, REG_EQUAL); break;
+    case OP_GREATER: emit_binary(t, REG_GREATER); break;
+    case OP_LESS: emit_binary(t, REG_LESS); break;
+
+    case OP_PRINT:
+        emit(t, REG_PRINT);
+        emit(t, rk(t, top(t)));
+        t->depth--;
+        break;
+
+    case OP_POP:
+        t->depth--;
+        break;
+
+    case OP_DUP:
+        push(t, top(t).kind, top(t).index);
+        break;
+
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+        emit(t, code[0] == OP_DEFINE_GLOBAL ? REG_DEFINE_GLOBAL : REG_SET_GLOBAL);
+        emit(t, code[1]);
+        emit(t, code[2]);
+        emit(t, rk(t, top(t)));
+        if (code[0] == OP_DEFINE_GLOBAL) t->depth--;
+        break;
+
+    case OP_GET_GLOBAL:
+        emit(t, REG_GET_GLOBAL);
+        emit(t, reg(t, push_home(t)));
+        emit(t, code[1]);
+        emit(t, code[2]);
+        break;
+
+    case OP_GET_LOCAL:
+        materialize(t, code[1]);
+        push(t, SYM_REG, code[1]);
+        break;
+
+    case OP_SET_LOCAL: {
+        int slot = code[1];
+        Sym value = top(t);
+        materialize_refs(t, slot);
+        if (!(value.kind == SYM_REG && value.index == slot)) {
+            emit(t, REG_MOVE);
+            emit(t, reg(t, slot));
+            emit(t, rk(t, t->stack[t->depth - 1]));
+        }
+        t->stack[slot].kind = SYM_REG;
+        t->stack[slot].index = slot;
+        break;
+    }
+
+    case OP_GET_UPVALUE:
+        emit(t, REG_GET_UPVALUE);
+        emit(t, reg(t, push_home(t)));
+        emit(t, code[1]);
+        break;
+
+    case OP_SET_UPVALUE:
+        emit(t, REG_SET_UPVALUE);
+        emit(t, code[1]);
+        emit(t, rk(t, top(t)));
+        break;
+
+    case OP_CLOSE_UPVALUE:
+        materialize(t, t->depth - 1);
+        emit(t, REG_CLOSE_UPVALUE);
+        emit(t, reg(t, t->depth - 1));
+        t->depth--;
+        break;
+
+    case OP_JUMP: emit_jump(t, REG_JUMP, offset); break;
+    case OP_JUMP_IF_FALSE: emit_jump(t, REG_JUMP_IF_FALSE, offset); break;
+    case OP_LOOP: emit_jump(t, REG_LOOP, offset); break;
+
+    case OP_CALL:
+    case OP_TAIL_CALL: {
+        // callee frame starts at callee register.
+        materialize_all(t);
+        int base = t->depth - code[1] - 1;
+        emit(t, code[0] == OP_TAIL_CALL ? REG_TAIL_CALL : REG_CALL);
+        emit(t, reg(t, base));
+        emit(t, code[1]);
+        t->depth = base;
+        push_home(t);
+        break;
+    }
+
+    case OP_CLOSURE: {
+        ObjFunction* func = AS_FUNCTION(in->constants.values[code[1]]);
+
+        // captured locals are taken by address.
+        for (int i = 0; i < func->upvalue_count; i++) {
+            if (code[2 + i * 2] && code[3 + i * 2] < t->depth) {
+                materialize(t, code[3 + i * 2]);
+            }
+        }
+
+        emit(t, REG_CLOSURE);
+        emit(t, reg(t, push_home(t)));
+        emit(t, code[1]);
+        for (int i = 0; i < func->upvalue_count * 2; i++) {
+            emit(t, code[2 + i]);
+        }
+        break;
+    }
+
+    case OP_RET:
+        emit(t, REG_RETURN);
+        emit(t, rk(t, top(t)));
+        t->depth--;
+        break;
+
+    default:
+        // superinstructions come from optimizer.c, it does not run here.
+        t->failed = true;
+        break;
+    }
+};
+
+static void patch_jumps(RegCompiler* t) {
+    for (int i = 0; i < t->jump_count; i++) {
+        RegJump* jump = &t->jumps[i];
+        int end = jump->at + jump->length;
+        int target = t->map[jump->old_target];
+        int distance = t->out->code[jump->at] == REG_LOOP ? end - target : target - end;
+        if (distance > UINT16_MAX) t->failed = true;
+
+        t->out->code[end - 2] = (distance >> 8) & 0xff;
+        t->out->code[end - 1] = distance & 0xff;
+    }
+};
+
+bool reg_compile(ObjFunction* function) {
+    RegCompiler t;
+    Chunk* in = &function->chunk;
+    int count = in->count;
+
+    t.function = function;
+    t.in = in;
+    t.out = &function->reg_chunk;
+    t.line = 0;
+    t.failed = false;
+    t.depth = 1; // slot 0 holds the callee
+    t.max_depth = 1;
+    t.stack[0].kind = SYM_REG;
+    t.stack[0].index = 0;
+    for (int i = 0; i < function->arity; i++) {
+        push_home(&t);
+    }
+
+    t.is_target = ALLOCATE(bool, count + 1);
+    t.depth_at = ALLOCATE(int, count + 1);
+    t.map = ALLOCATE(int, count + 1);
+    t.jumps = ALLOCATE(RegJump, count);
+    t.jump_count = 0;
+
+    memset(t.is_target, 0, sizeof(bool) * (count + 1));
+    t.depth_at[count] = -1;
+    for (int offset = 0; offset < count; offset += chunk_instruction_length(in, offset)) {
+        uint8_t op = in->code[offset];
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP) {
+            t.is_target[jump_target(in, offset)] = true;
+        }
+    }
+
+    // code after return/continue/jumps nobody targets stays at -1.
+    if (chunk_stack_depths(in, t.depth, t.depth_at) < 0) t.failed = true;
+
+    bool live = true; // previous instruction falls through
+    for (int offset = 0; offset < count && !t.failed; offset += chunk_instruction_length(in, offset)) {
+        t.line = in->lines[offset];
+
+        if (t.depth_at[offset] < 0) {
+            t.map[offset] = t.out->count;
+            live = false;
+            continue;
+        }
+
+        if (t.is_target[offset] || !live) {
+            // fall through gets to the label in the same shape as jumps.
+            if (live) materialize_all(&t);
+            t.depth = t.depth_at[offset];
+            for (int i = 0; i < t.depth; i++) {
+                t.stack[i].kind = SYM_REG;
+                t.stack[i].index = i;
+            }
+        }
+
+        t.map[offset] = t.out->count;
+        translate(&t, offset);
+
+        uint8_t op = in->code[offset];
+        live = op != OP_JUMP && op != OP_LOOP && op != OP_RET;
+    }
+    t.map[count] = t.out->count;
+
+    if (!t.failed) patch_jumps(&t);
+    function->reg_count = t.max_depth;
+
+    MEM_FREE(bool, t.is_target, count + 1);
+    MEM_FREE(int, t.depth_at, count + 1);
+    MEM_FREE(int, t.map, count + 1);
+    MEM_FREE(RegJump, t.jumps, count);
+    return !t.failed;
+};
+
+int reg_instruction_length(ObjFunction* function, int offset) {
+    Chunk* chunk = &function->reg_chunk;
+    switch (chunk->code[offset])
+    {
+    case REG_NULL:
+    case REG_TRUE:
+    case REG_FALSE:
+    case REG_PRINT:
+    case REG_CLOSE_UPVALUE:
+    case REG_RETURN:
+        return 2;
+
+    case REG_MOVE:
+    case REG_LOADK:
+    case REG_NEGATE:
+    case REG_NOT:
+    case REG_GET_UPVALUE:
+    case REG_SET_UPVALUE:
+    case REG_JUMP:
+    case REG_LOOP:
+    case REG_CALL:
+    case REG_TAIL_CALL:
+        return 3;
+
+    case REG_ADD:
+    case REG_SUB:
+    case REG_MUL:
+    case REG_DIV:
+    case REG_EQUAL:
+    case REG_GREATER:
+    case REG_LESS:
+    case REG_DEFINE_GLOBAL:
+    case REG_SET_GLOBAL:
+    case REG_GET_GLOBAL:
+    case REG_JUMP_IF_FALSE:
+        return 4;
+
+    case REG_CLOSURE: {
+        ObjFunction* func = AS_FUNCTION(function->chunk.constants.values[chunk->code[offset + 2]]);
+        return 3 + func->upvalue_count * 2;
+    }
+
+    default:
+        return 1;
+    }
+};
@@ -0,0 +1,431 @@
+#include "regvm.h"
+#include "object.h"
+#include "gc.h"
+#include "profiler.h"
+#include "trace.h"
+#include "string.h"
+
+static int frame_reg_count(CallFrame* frame) {
+    return get_frame_function(frame)->reg_count;
+};
+
+// registers are stack slots: frame's ones are kept under stack top,
+// so gc sees them as roots.
+static bool reg_call(Value* base, int arg_count) {
+    Value callee = *base;
+    ObjFunction* function;
+    if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_CLOSURE) {
+        function = AS_CLOSURE(callee)->function;
+    } else if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_FUNCTION) {
+        function = AS_FUNCTION(callee);
+    } else {
+        // natives and errors: stack vm way, result lands in *base.
+        Value* top = vm.stack_top;
+        vm.stack_top = base + arg_count + 1;
+        if (!call_value(callee, arg_count)) return false;
+        vm.stack_top = top;
+        return true;
+    }
+
+    if (arg_count != function->arity) {
+        runtime_error("Expected %d arguments but got %d.",
+            function->arity, arg_count);
+        return false;
+    }
+
+    if (!vm_frames_ensure()) {
+        runtime_error("Stack overflow: more than %d frames.", VM_FRAMES_MAX);
+        return false;
+    }
+
+    // stack may move, base is rebased with it.
+    int base_index = (int)(base - vm.stack);
+    if (!vm_stack_ensure(base_index + function->reg_count + VM_STACK_EXTRA)) {
+        runtime_error("Stack overflow: more than %d values.", VM_STACK_MAX);
+        return false;
+    }
+    base = vm.stack + base_index;
+
+    CallFrame* frame = &vm.frames[vm.frames_count++];
+    frame->function = AS_OBJ(callee);
+    frame->ip = function->reg_chunk.code;
+    frame->slots = base;
+
+    // registers above args may keep values of finished calls.
+    for (Value* r = base + arg_count + 1; r < base + function->reg_count; r++) {
+        *r = NULL_VAL;
+    }
+    vm.stack_top = base + function->reg_count;
+    return true;
+};
+
+// callee and args move down to the frame's registers, the frame is
+// reused for the call. Natives and bad calls go the reg_call way,
+// REG_RETURN after the tail call returns their result.
+static bool reg_tail_call(Value* base, int arg_count) {
+    Value callee = *base;
+    ObjFunction* function = NULL;
+    if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_CLOSURE) {
+        function = AS_CLOSURE(callee)->function;
+    } else if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_FUNCTION) {
+        function = AS_FUNCTION(callee);
+    }
+    if (function == NULL || function->arity != arg_count) {
+        return reg_call(base, arg_count);
+    }
+
+    Value* slots = vm.frames[vm.frames_count - 1].slots;
+    close_copy_upvalues(slots);
+    memmove(slots, base, sizeof(Value) * (arg_count + 1));
+    vm.frames_count--;
+    return reg_call(slots, arg_count);
+};
+
+static inline Value rk_value(Value* R, Value* K, uint8_t operand) {
+    return operand & REG_RK_CONST ? K[operand & REG_RK_MAX] : R[operand];
+};
+
+static INTERPRET_RESULT reg_run() {
+    CallFrame* frame = &vm.frames[vm.frames_count - 1];
+
+    register uint8_t* ip = frame->ip;
+    register Value* R = frame->slots;
+    // constants buffer doesn't move with its function on promotion.
+    Value* K = get_frame_function(frame)->chunk.constants.values;
+
+    #define READ_BYTE() (*ip++)
+    #define READ_SHORT() \
+        (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+    #define RK(operand) rk_value(R, K, (operand))
+    #define GLOBAL_NAME(slot) AS_STRING(vm.global_names.values[slot])
+    #define LOAD_FRAME() \
+        do { \
+            frame = &vm.frames[vm.frames_count - 1]; \
+            ip = frame->ip; \
+            R = frame->slots; \
+            K = get_frame_function(frame)->chunk.constants.values; \
+        } while (false)
+    #define RUNTIME_ERROR(...) \
+        do { \
+            frame->ip = ip; \
+            runtime_error(__VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+    // same rules as BINARY_OP in vm.c: numbers only, REG_ADD also concats.
+    #define ARITH_OP(valueType, operation) \
+        do { \
+            uint8_t a = READ_BYTE(); \
+            Value b = RK(READ_BYTE()); \
+            Value c = RK(READ_BYTE()); \
+            if (!IS_NUMBER(b) || !IS_NUMBER(c)) { \
+                RUNTIME_ERROR("Operands must be numbers in BinaryOp."); \
+            } \
+            R[a] = valueType(AS_NUMBER(b) operation AS_NUMBER(c)); \
+        } while (false)
+
+    #ifdef DEBUG_TRACE_EXECUTION
+    // dump frame registers and instruction before executing it (trace.h).
+    #define TRACE_INSTRUCTION() \
+        do { \
+            if (trace.instructions) trace_reg_instruction(frame, ip, R); \
+        } while (false)
+    #else
+    #define TRACE_INSTRUCTION() do {} while (false)
+    #endif
+
+    #ifdef VM_COMPUTED_GOTO
+    static void* dispatch_table[REG_CODE_COUNT] = {
+        [REG_MOVE] = &&L_REG_MOVE,
+        [REG_LOADK] = &&L_REG_LOADK,
+        [REG_NULL] = &&L_REG_NULL,
+        [REG_TRUE] = &&L_REG_TRUE,
+        [REG_FALSE] = &&L_REG_FALSE,
+        [REG_NEGATE] = &&L_REG_NEGATE,
+        [REG_NOT] = &&L_REG_NOT,
+        [REG_ADD] = &&L_REG_ADD,
+        [REG_SUB] = &&L_REG_SUB,
+        [REG_MUL] = &&L_REG_MUL,
+        [REG_DIV] = &&L_REG_DIV,
+        [REG_EQUAL] = &&L_REG_EQUAL,
+        [REG_GREATER] = &&L_REG_GREATER,
+        [REG_LESS] = &&L_REG_LESS,
+        [REG_PRINT] = &&L_REG_PRINT,
+        [REG_DEFINE_GLOBAL] = &&L_REG_DEFINE_GLOBAL,
+        [REG_SET_GLOBAL] = &&L_REG_SET_GLOBAL,
+        [REG_GET_GLOBAL] = &&L_REG_GET_GLOBAL,
+        [REG_GET_UPVALUE] = &&L_REG_GET_UPVALUE,
+        [REG_SET_UPVALUE] = &&L_REG_SET_UPVALUE,
+        [REG_CLOSE_UPVALUE] = &&L_REG_CLOSE_UPVALUE,
+        [REG_JUMP] = &&L_REG_JUMP,
+        [REG_JUMP_IF_FALSE] = &&L_REG_JUMP_IF_FALSE,
+        [REG_LOOP] = &&L_REG_LOOP,
+        [REG_CALL] = &&L_REG_CALL,
+        [REG_TAIL_CALL] = &&L_REG_TAIL_CALL,
+        [REG_CLOSURE] = &&L_REG_CLOSURE,
+        [REG_RETURN] = &&L_REG_RETURN,
+    };
+
+    #define DISPATCH() \
+        do { \
+            TRACE_INSTRUCTION(); \
+            COUNT_INSTRUCTION(); \
+            goto *dispatch_table[READ_BYTE()]; \
+        } while (false)
+    #define VM_CASE(op) L_##op:
+    #define VM_NEXT() DISPATCH()
+    #else
+    #define VM_CASE(op) case op:
+    #define VM_NEXT() break
+    #endif
+
+    #ifdef VM_COMPUTED_GOTO
+    DISPATCH();
+    #else
+    for (;;) {
+        TRACE_INSTRUCTION();
+        COUNT_INSTRUCTION();
+        switch (READ_BYTE())
+    #endif
+    {
+        VM_CASE(REG_MOVE) {
+            uint8_t a = READ_BYTE();
+            R[a] = RK(READ_BYTE());
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_LOADK) {
+            uint8_t a = READ_BYTE();
+            R[a] = K[READ_BYTE()];
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_NULL) R[READ_BYTE()] = NULL_VAL; VM_NEXT();
+        VM_CASE(REG_TRUE) R[READ_BYTE()] = BOOL_VAl(true); VM_NEXT();
+        VM_CASE(REG_FALSE) R[READ_BYTE()] = BOOL_VAl(false); VM_NEXT();
+
+        VM_CASE(REG_NEGATE) {
+            uint8_t a = READ_BYTE();
+            Value b = RK(READ_BYTE());
+            if (!IS_NUMBER(b)) {
+                RUNTIME_ERROR("Operand must be a number.");
+            }
+
+            R[a] = NUMBER_VAL(-AS_NUMBER(b));
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_NOT) {
+            uint8_t a = READ_BYTE();
+            R[a] = BOOL_VAl(bool_is_falsey(RK(READ_BYTE())));
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_ADD) {
+            uint8_t a = READ_BYTE();
+            Value b = RK(READ_BYTE());
+            Value c = RK(READ_BYTE());
+            if (IS_NUMBER(b) && IS_NUMBER(c)) {
+                R[a] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+                VM_NEXT();
+            }
+
+            if (!IS_TEXT(b) || !IS_TEXT(c)) {
+                RUNTIME_ERROR("Operands must be numbers in BinaryOp.");
+            }
+            frame->ip = ip;
+            vm_stack_push(b);
+            vm_stack_push(c);
+            R[a] = strings_concat();
+            VM_NEXT();
+        }
+        VM_CASE(REG_SUB) ARITH_OP(NUMBER_VAL, -); VM_NEXT();
+        VM_CASE(REG_MUL) ARITH_OP(NUMBER_VAL, *); VM_NEXT();
+        VM_CASE(REG_DIV) ARITH_OP(NUMBER_VAL, /); VM_NEXT();
+        VM_CASE(REG_LESS) ARITH_OP(BOOL_VAl, <); VM_NEXT();
+        VM_CASE(REG_GREATER) ARITH_OP(BOOL_VAl, >); VM_NEXT();
+
+        VM_CASE(REG_EQUAL) {
+            uint8_t a = READ_BYTE();
+            Value b = RK(READ_BYTE());
+            Value c = RK(READ_BYTE());
+            R[a] = BOOL_VAl(valuesEqual(b, c));
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_PRINT)
+            print_line(RK(READ_BYTE()));
+            VM_NEXT();
+
+        VM_CASE(REG_DEFINE_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            Value value = RK(READ_BYTE());
+            vm.global_values.values[slot] = value;
+            if (GC_IS_YOUNG_VALUE(value)) vm.globals_has_young = true;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_SET_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            Value value = RK(READ_BYTE());
+            Value* global = &vm.global_values.values[slot];
+            if (IS_UNDEFINED(*global)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
+            }
+
+            *global = value;
+            if (GC_IS_YOUNG_VALUE(value)) vm.globals_has_young = true;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_GET_GLOBAL) {
+            uint8_t a = READ_BYTE();
+            uint16_t slot = READ_SHORT();
+            Value value = vm.global_values.values[slot];
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
+            }
+
+            R[a] = value;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_GET_UPVALUE) {
+            uint8_t a = READ_BYTE();
+            uint8_t index = READ_BYTE();
+            R[a] = *((ObjClosure*)frame->function)->upvalues[index]->location;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_SET_UPVALUE) {
+            uint8_t index = READ_BYTE();
+            Value value = RK(READ_BYTE());
+            ObjUpvalue* upv = ((ObjClosure*)frame->function)->upvalues[index];
+            *upv->location = value;
+            GC_WRITE_BARRIER(upv, value);
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_CLOSE_UPVALUE)
+            close_copy_upvalues(&R[READ_BYTE()]);
+            VM_NEXT();
+
+        VM_CASE(REG_JUMP) {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_JUMP_IF_FALSE) {
+            uint8_t a = READ_BYTE();
+            uint16_t offset = READ_SHORT();
+            if (bool_is_falsey(R[a])) ip += offset;
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_LOOP) {
+            uint16_t offset = READ_SHORT();
+            PROFILER_SAFEPOINT(frame, ip);
+            ip -= offset;
+            GC_SAFEPOINT();
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_CALL) {
+            uint8_t a = READ_BYTE();
+            int arg_count = READ_BYTE();
+
+            frame->ip = ip;
+            PROFILER_SAFEPOINT(frame, ip);
+            GC_SAFEPOINT();
+
+            if (!reg_call(&R[a], arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            LOAD_FRAME();
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_TAIL_CALL) {
+            uint8_t a = READ_BYTE();
+            int arg_count = READ_BYTE();
+
+            frame->ip = ip;
+            PROFILER_SAFEPOINT(frame, ip);
+            GC_SAFEPOINT();
+
+            if (!reg_tail_call(&R[a], arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            LOAD_FRAME();
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_CLOSURE) {
+            uint8_t a = READ_BYTE();
+            ObjFunction* func = AS_FUNCTION(K[READ_BYTE()]);
+            ObjClosure* closure = new_closure(func);
+            R[a] = OBJ_VAL(closure);
+
+            for (int i = 0; i < closure->upvalues_count; i++) {
+                uint8_t upv_local = READ_BYTE();
+                uint8_t upv_index = READ_BYTE();
+                if (upv_local) {
+                    closure->upvalues[i] = capture_upvalue(R + upv_index);
+                } else {
+                    closure->upvalues[i] = ((ObjClosure*)frame->function)->upvalues[upv_index];
+                }
+                GC_WRITE_BARRIER(closure, OBJ_VAL(closure->upvalues[i]));
+            }
+
+            VM_NEXT();
+        }
+
+        VM_CASE(REG_RETURN) {
+            Value result = RK(READ_BYTE());
+            close_copy_upvalues(R);
+            vm.frames_count--;
+
+            if (vm.frames_count == 0) {
+                vm.stack_top = vm.stack;
+                return INTERPRET_OK;
+            }
+
+            // callee register of the caller gets the result.
+            R[0] = result;
+            LOAD_FRAME();
+            vm.stack_top = R + frame_reg_count(frame);
+            VM_NEXT();
+        }
+
+    #ifndef VM_COMPUTED_GOTO
+        default:
+            VM_NEXT();
+        }
+    #endif
+    }
+
+    #ifdef VM_COMPUTED_GOTO
+    #undef DISPATCH
+    #endif
+    #undef VM_CASE
+    #undef VM_NEXT
+    #undef TRACE_INSTRUCTION
+    #undef ARITH_OP
+    #undef RUNTIME_ERROR
+    #undef LOAD_FRAME
+    #undef GLOBAL_NAME
+    #undef RK
+    #undef READ_SHORT
+    #undef READ_BYTE
+};
+
+INTERPRET_RESULT reg_interpret() {
+    // script closure is at vm.stack[0], its frame starts there.
+    if (!reg_call(vm.stack, 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return reg_run();
+};
@@ -0,0 +1,69 @@
+#ifndef CVM_REGVM_H
+#define CVM_REGVM_H
+
+#include "common.h"
+#include "vm.h"
+
+/*
+    Register backend (vm.backend == BACKEND_REGISTER).
+
+    Same front end: compiler.c emits stack bytecode, reg_compile()
+    translates it into three-address code kept in function->reg_chunk.
+    Registers are the frame's stack slots: locals keep their slot,
+    temporaries take the slot the stack vm would have pushed to.
+    Translation keeps operands symbolic (local or constant) until
+    an instruction needs them, so `a + 1` is a single REG_ADD.
+
+    Operand encoding:
+        A   - destination register, 1 byte
+        B/C - RK operand, 1 byte: register below REG_RK_CONST,
+              constant (index | REG_RK_CONST) otherwise
+        Bx  - 2 byte operand (global slot, jump offset)
+*/
+
+#define REG_RK_CONST 0x80
+#define REG_RK_MAX 0x7f
+
+typedef enum {
+    REG_MOVE, // A B: R[A] = RK(B)
+    REG_LOADK, // A K: R[A] = K[K], constants out of RK range
+    REG_NULL, // A
+    REG_TRUE, // A
+    REG_FALSE, // A
+    REG_NEGATE, // A B
+    REG_NOT, // A B
+    REG_ADD, // A B C: R[A] = RK(B) + RK(C)
+    REG_SUB,
+    REG_MUL,
+    REG_DIV,
+    REG_EQUAL,
+    REG_GREATER,
+    REG_LESS,
+    REG_PRINT, // B
+    REG_DEFINE_GLOBAL, // Bx B
+    REG_SET_GLOBAL, // Bx B
+    REG_GET_GLOBAL, // A Bx
+    REG_GET_UPVALUE, // A index
+    REG_SET_UPVALUE, // index B
+    REG_CLOSE_UPVALUE, // A: close upvalues from R[A] up
+    REG_JUMP, // Bx
+    REG_JUMP_IF_FALSE, // A Bx
+    REG_LOOP, // Bx
+    REG_CALL, // A argc: callee in R[A], args above, result in R[A]
+    REG_TAIL_CALL, // A argc: REG_CALL reusing the frame, REG_RETURN follows
+    REG_CLOSURE, // A K, (is_local, index) pairs
+    REG_RETURN, // B
+    // opcodes count, keep it last.
+    REG_CODE_COUNT,
+} REG_OP;
+
+// translate function->chunk into function->reg_chunk.
+bool reg_compile(ObjFunction* function);
+
+// size in bytes of register instruction at offset.
+int reg_instruction_length(ObjFunction* function, int offset);
+
+// run script closure placed at vm.stack[0].
+INTERPRET_RESULT reg_interpret();
+
+#endif
@@ -6,7 +6,7 @@ typedef struct {
     int line;
 } Scanner;
 
-Scanner scanner;
+_Thread_local Scanner scanner;
 
 bool is_at_end() {
     return *scanner.current == '\0';
@@ -241,11 +241,10 @@ Token scan_token() {
 
     // literals
     case '"': return string();
-
-    default:
-        printf("CHAR='%c'\n", c);
-        return make_error_token("Unexpected character.");
     }
+
+    printf("CHAR='%c'\n", c);
+    return make_error_token("Unexpected character.");
 }
 
 void scanner_init(const char* source) {
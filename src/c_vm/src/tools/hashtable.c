@@ -1,139 +1,239 @@
 #include "hashtable.h"
 #include "string.h"
+#include "../gc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// rebuild once only 1/8 of slots are empty.
+#define HASHTABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+#define HASH_GROUP(hash) ((hash) >> 7)
+#define HASH_TAG(hash) ((int8_t)((hash) & 0x7F))
+
+// bit i is set if control byte i of the group equals `tag`.
+static inline uint32_t group_match(const int8_t* group, int8_t tag) {
+    #ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+    #else
+    uint32_t bits = 0;
+    for (int i = 0; i < HASHTABLE_GROUP; i++) {
+        bits |= (uint32_t)(group[i] == tag) << i;
+    }
+    return bits;
+    #endif
+};
+
+// empty and deleted slots: control bytes with the sign bit set.
+static inline uint32_t group_match_free(const int8_t* group) {
+    #ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+    #else
+    uint32_t bits = 0;
+    for (int i = 0; i < HASHTABLE_GROUP; i++) {
+        bits |= (uint32_t)(group[i] < 0) << i;
+    }
+    return bits;
+    #endif
+};
 
-#define HASHTABLE_MAX_LOAD_TO_GROW 0.75
+static inline uint32_t groups_mask(Hashtable* t) {
+    return (uint32_t)(t->capacity / HASHTABLE_GROUP) - 1;
+};
 
 void hashtable_init(Hashtable* t) {
-    t->capacity = 0;
     t->count = 0;
-    t->entries = NULL;
+    t->capacity = 0;
+    t->growth_left = 0;
+    t->ctrl = NULL;
+    t->keys = NULL;
+    t->values = NULL;
+    t->has_young = false;
+};
+
+static size_t table_bytes(int capacity) {
+    return (size_t)capacity * (sizeof(int8_t) + sizeof(ObjString*) + sizeof(Value));
 };
 
 void destroy_hashtable(Hashtable* t) {
-    free(t->entries);
+    realloc_ptr(t->ctrl, table_bytes(t->capacity), 0);
     hashtable_init(t);
 };
 
-Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
+static int find_slot(Hashtable* t, ObjString* key) {
+    if (t->count == 0) return -1;
+
+    uint32_t mask = groups_mask(t);
+    uint32_t group = HASH_GROUP(key->hash) & mask;
+    int8_t tag = HASH_TAG(key->hash);
+    for (uint32_t step = 1;; step++) {
+        int8_t* ctrl = t->ctrl + group * HASHTABLE_GROUP;
+        for (uint32_t bits = group_match(ctrl, tag); bits != 0; bits &= bits - 1) {
+            int slot = (int)(group * HASHTABLE_GROUP) + __builtin_ctz(bits);
+            if (t->keys[slot] == key) return slot;
+        }
 
-uint32_t index = key->hash & (capacity - 1);
+        if (group_match(ctrl, HASHTABLE_EMPTY) != 0) return -1;
+        group = (group + step) & mask;
+    }
+};
+
+// first empty or deleted slot on the probe sequence of `hash`.
+static int free_slot(Hashtable* t, uint32_t hash) {
+    uint32_t mask = groups_mask(t);
+    uint32_t group = HASH_GROUP(hash) & mask;
+    for (uint32_t step = 1;; step++) {
+        uint32_t bits = group_match_free(t->ctrl + group * HASHTABLE_GROUP);
+        if (bits != 0) return (int)(group * HASHTABLE_GROUP) + __builtin_ctz(bits);
+        group = (group + step) & mask;
+    }
+};
 
-  Entry* tombstone = NULL;
-  
-  for (;;) {
-    Entry* entry = &entries[index];
+static void fill_slot(Hashtable* t, int slot, ObjString* key, Value value) {
+    if (t->ctrl[slot] == HASHTABLE_EMPTY) t->growth_left--;
+    t->ctrl[slot] = HASH_TAG(key->hash);
+    t->keys[slot] = key;
+    t->values[slot] = value;
+    t->count++;
+};
 
-//> find-tombstone
-    if (entry->key == NULL) {
-      if (IS_NULL(entry->value)) {
-        // Empty entry.
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        // We found a tombstone.
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) {
-      // We found the key.
-      return entry;
+// a group with an empty slot has never been full, no probe went past it.
+static void erase_slot(Hashtable* t, int slot) {
+    int8_t* group = t->ctrl + (slot & ~(HASHTABLE_GROUP - 1));
+    if (group_match(group, HASHTABLE_EMPTY) != 0) {
+        t->ctrl[slot] = HASHTABLE_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[slot] = HASHTABLE_DELETED;
     }
 
-    index = (index + 1) & (capacity - 1);
-  }
-}
+    t->keys[slot] = NULL;
+    t->values[slot] = NULL_VAL;
+    t->count--;
+};
 
-void adjust_capacity(Hashtable* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
+// doubles, or drops tombstones in place when they took the room.
+static void rebuild(Hashtable* t) {
+    int capacity = t->capacity;
+    if (capacity == 0) {
+        capacity = HASHTABLE_GROUP;
+    } else if (t->count + 1 > HASHTABLE_MAX_LOAD(capacity) / 2) {
+        capacity *= 2;
+    }
+
+    // allocation may run gc, table must be intact until it returns.
+    Hashtable fresh;
+    hashtable_init(&fresh);
+    fresh.ctrl = (int8_t*)MEM_MALLOC(table_bytes(capacity));
+    fresh.keys = (ObjString**)(fresh.ctrl + capacity);
+    fresh.values = (Value*)(fresh.keys + capacity);
+    fresh.capacity = capacity;
+    fresh.growth_left = HASHTABLE_MAX_LOAD(capacity);
+    fresh.has_young = t->has_young;
+    memset(fresh.ctrl, (uint8_t)HASHTABLE_EMPTY, capacity);
     for (int i = 0; i < capacity; i++) {
-      entries[i].key = NULL;
-      entries[i].value = NULL_VAL;
+        fresh.keys[i] = NULL;
+        fresh.values[i] = NULL_VAL;
     }
-  //> re-hash
-  
-  //> resize-init-count
-    table->count = 0;
-  //< resize-init-count
-    for (int i = 0; i < table->capacity; i++) {
-      Entry* entry = &table->entries[i];
-      if (entry->key == NULL) continue;
-  
-      Entry* dest = find_entry(entries, capacity, entry->key);
-      dest->key = entry->key;
-      dest->value = entry->value;
-  //> resize-increment-count
-      table->count++;
-  //< resize-increment-count
+
+    for (int i = 0; i < t->capacity; i++) {
+        if (!HASHTABLE_SLOT_FULL(t, i)) continue;
+        ObjString* key = t->keys[i];
+        fill_slot(&fresh, free_slot(&fresh, key->hash), key, t->values[i]);
     }
 
-    free(table->entries);
-    table->entries = entries;
-    table->capacity = capacity;
-}
-
-bool hashtable_set(Hashtable* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * HASHTABLE_MAX_LOAD_TO_GROW) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjust_capacity(table, capacity);
-      }
-    
-    //< table-set-grow
-      Entry* entry = find_entry(table->entries, table->capacity, key);
-      bool isNewKey = entry->key == NULL;
-    /* Hash Tables table-set < Hash Tables set-increment-count
-      if (isNewKey) table->count++;
-    */
-    //> set-increment-count
-      if (isNewKey && IS_NULL(entry->value)) table->count++;
-    //< set-increment-count
-    
-      entry->key = key;
-      entry->value = value;
-      return isNewKey;
+    destroy_hashtable(t);
+    *t = fresh;
+};
+
+bool hashtable_set(Hashtable* t, ObjString* key, Value value) {
+    int slot = find_slot(t, key);
+    bool is_new_key = slot < 0;
+    if (is_new_key) {
+        if (t->capacity == 0) rebuild(t);
+
+        slot = free_slot(t, key->hash);
+        if (t->ctrl[slot] == HASHTABLE_EMPTY && t->growth_left == 0) {
+            rebuild(t);
+            slot = free_slot(t, key->hash);
+        }
+        fill_slot(t, slot, key, value);
+    } else {
+        t->values[slot] = value;
+    }
+
+    if (key->obj.is_young || GC_IS_YOUNG_VALUE(value)) {
+        t->has_young = true;
+    }
+    return is_new_key;
 };
 
 void hashtable_copy(Hashtable* from, Hashtable* to) {
     for (int i = 0; i < from->capacity; i++) {
-        Entry* e = &from->entries[i];
-        if (e->key == NULL) continue;
-        hashtable_set(to, e->key, e->value);
+        if (!HASHTABLE_SLOT_FULL(from, i)) continue;
+        hashtable_set(to, from->keys[i], from->values[i]);
     }
 };
 
-bool hashtable_get(Hashtable* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
+bool hashtable_get(Hashtable* t, ObjString* key, Value* value) {
+    int slot = find_slot(t, key);
+    if (slot < 0) return false;
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-  
-    *value = entry->value;
+    *value = t->values[slot];
     return true;
 };
 
 bool hashtable_delete(Hashtable* t, ObjString* key) {
-    if (t->count <= 0) return false;
-
-    Entry* en = find_entry(t->entries, t->capacity, key);
-    if (en->key == NULL) return false;
+    int slot = find_slot(t, key);
+    if (slot < 0) return false;
 
-    en->key = NULL;
-    en->value = BOOL_VAl(true);
+    erase_slot(t, slot);
     return true;
 };
 
 ObjString* hashtable_find_string(Hashtable* t, const char* chars, int length, uint32_t hash) {
-    if (t->count <= 0) return NULL;
-
-    uint32_t index = hash % t->capacity;
-    for (;;) {
-        Entry* en = &t->entries[index];
-        if (en->key == NULL) {
-            if (IS_NULL(en->value)) return NULL;
-        }
-        else if (en->key->length == length &&
-            en->key->hash == hash &&
-            memcmp(en->key->chars, chars, length) == 0) {
-                return en->key;
+    if (t->count == 0) return NULL;
+
+    uint32_t mask = groups_mask(t);
+    uint32_t group = HASH_GROUP(hash) & mask;
+    int8_t tag = HASH_TAG(hash);
+    for (uint32_t step = 1;; step++) {
+        int8_t* ctrl = t->ctrl + group * HASHTABLE_GROUP;
+        for (uint32_t bits = group_match(ctrl, tag); bits != 0; bits &= bits - 1) {
+            ObjString* key = t->keys[group * HASHTABLE_GROUP + __builtin_ctz(bits)];
+            if (key->hash == hash &&
+                key->length == length &&
+                memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
         }
 
-        index = (index + 1) % t->capacity;
+        if (group_match(ctrl, HASHTABLE_EMPTY) != 0) return NULL;
+        group = (group + step) & mask;
     }
-};
\ No newline at end of file
+};
+
+// key moved in memory (promotion), hash is the same.
+void hashtable_replace_key(Hashtable* t, ObjString* key, ObjString* new_key) {
+    int slot = find_slot(t, key);
+    if (slot >= 0) t->keys[slot] = new_key;
+};
+
+void hashtable_mark(Hashtable* t) {
+    for (int i = 0; i < t->capacity; i++) {
+        if (!HASHTABLE_SLOT_FULL(t, i)) continue;
+        gc_mark_object((Obj*)t->keys[i]);
+        gc_mark_value(t->values[i]);
+    }
+};
+
+// weak table support: drop entries with keys not reached by gc.
+void hashtable_remove_white(Hashtable* t) {
+    for (int i = 0; i < t->capacity; i++) {
+        if (HASHTABLE_SLOT_FULL(t, i) && !t->keys[i]->obj.is_marked) {
+            erase_slot(t, i);
+        }
+    }
+};
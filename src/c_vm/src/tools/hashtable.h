@@ -6,17 +6,35 @@
 #include "../common.h"
 #include "../object.h"
 
-typedef struct {
-    ObjString* key;
-    Value value;
-} Entry;
+/*
+    Swiss table: open addressing over groups of HASHTABLE_GROUP slots.
+    Per slot one control byte: HASHTABLE_EMPTY, HASHTABLE_DELETED or,
+    for a full slot, the low 7 bits of the key hash. A lookup compares
+    the 7 bits against a whole group at once (SSE2 when available) and
+    touches keys only on a match; it stops at the first group that has
+    an empty slot. Groups are probed triangularly: hash >> 7, +1, +2, ...
+
+    Keys and values are separate dense arrays, one allocation with ctrl.
+    Deletion leaves a tombstone only in a group that has been full:
+    a group with an empty slot never made a probe pass it.
+*/
+
+#define HASHTABLE_GROUP 16
+#define HASHTABLE_EMPTY ((int8_t)-128)
+#define HASHTABLE_DELETED ((int8_t)-2)
 
 typedef struct Hashtable {
-    int count;
-    int capacity;
-    Entry* entries;
+    int count; // live keys
+    int capacity; // slots: 0 or a power of two >= HASHTABLE_GROUP
+    int growth_left; // empty slots that may be filled before a rebuild
+    int8_t* ctrl;
+    ObjString** keys; // NULL in empty and deleted slots
+    Value* values;
+    bool has_young; // write barrier: holds nursery objects
 } Hashtable;
 
+#define HASHTABLE_SLOT_FULL(table, slot) ((table)->ctrl[slot] >= 0)
+
 void hashtable_init(Hashtable* t);
 
 void destroy_hashtable(Hashtable* t);
@@ -31,4 +49,10 @@ bool hashtable_delete(Hashtable* t, ObjString* key);
 
 ObjString* hashtable_find_string(Hashtable* t, const char* chars, int length, uint32_t hash);
 
-#endif
\ No newline at end of file
+void hashtable_replace_key(Hashtable* t, ObjString* key, ObjString* new_key);
+
+void hashtable_mark(Hashtable* t);
+
+void hashtable_remove_white(Hashtable* t);
+
+#endif
@@ -0,0 +1,51 @@
+#include "mapped_file.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+
+bool mapped_file_open(MappedFile* file, const char* path) {
+    file->chars = NULL;
+    file->length = 0;
+    file->mapped = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped = (length / page + 1) * page;
+
+    // zero pages first, the file goes over their beginning.
+    char* chars = (char*)mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chars == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (length > 0 &&
+        mmap(chars, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(chars, mapped);
+        close(fd);
+        return false;
+    }
+
+    close(fd);
+    file->chars = chars;
+    file->length = length;
+    file->mapped = mapped;
+    return true;
+};
+
+void mapped_file_close(MappedFile* file) {
+    if (file->chars != NULL) munmap((void*)file->chars, file->mapped);
+    file->chars = NULL;
+    file->length = 0;
+    file->mapped = 0;
+};
@@ -0,0 +1,24 @@
+#ifndef CVM_TOOLS_MAPPED_FILE_H
+#define CVM_TOOLS_MAPPED_FILE_H
+
+#include "../common.h"
+
+/*
+    Script source mapped read-only: no copy, pages are read in as the
+    scanner walks them. chars is '\0' terminated like a read buffer:
+    past the end of file the last page is zero, a file ending right on
+    a page boundary gets one more zero page behind it.
+*/
+
+typedef struct {
+    const char* chars;
+    size_t length;
+    size_t mapped; // bytes to unmap
+} MappedFile;
+
+// false if the file can't be opened or mapped (not a regular file).
+bool mapped_file_open(MappedFile* file, const char* path);
+
+void mapped_file_close(MappedFile* file);
+
+#endif
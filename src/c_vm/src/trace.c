@@ -0,0 +1,177 @@
+#include "trace.h"
+#include "debug.h"
+#include "object.h"
+#include "stdlib.h"
+#include "string.h"
+
+Trace trace = {
+    .instructions = false,
+    .code = false,
+    .function = NULL,
+    .ops_spec = NULL,
+    .rate = 1,
+    .skipped = 0,
+    .path = NULL,
+    .out = NULL,
+};
+
+static char trace_buffer[TRACE_BUFFER_SIZE];
+
+static bool starts_with(const char* arg, const char* prefix, const char** value) {
+    size_t length = strlen(prefix);
+    if (strncmp(arg, prefix, length) != 0) return false;
+
+    *value = arg + length;
+    return true;
+};
+
+bool trace_option(const char* arg) {
+    const char* value;
+    if (strcmp(arg, "--trace") == 0) {
+        trace.instructions = true;
+    } else if (strcmp(arg, "--trace-code") == 0) {
+        trace.code = true;
+    } else if (starts_with(arg, "--trace-fn=", &value)) {
+        trace.function = value;
+    } else if (starts_with(arg, "--trace-ops=", &value)) {
+        trace.ops_spec = value;
+    } else if (starts_with(arg, "--trace-rate=", &value)) {
+        char* end;
+        long rate = strtol(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || rate < 1) return false;
+        trace.rate = (uint32_t)rate;
+    } else if (starts_with(arg, "--trace-file=", &value)) {
+        trace.path = value;
+    } else {
+        return false;
+    }
+
+    #ifndef DEBUG_TRACE_EXECUTION
+    fprintf(stderr, "%s: release build, tracing is compiled out.\n", arg);
+    #endif
+    return true;
+};
+
+// "ADD,GET_LOCAL" -> trace.ops, names as disassembler prints them.
+static bool resolve_ops(VM_BACKEND backend) {
+    memset(trace.ops, trace.ops_spec == NULL, sizeof(trace.ops));
+    if (trace.ops_spec == NULL) return true;
+
+    const char* name = trace.ops_spec;
+    while (*name != '\0') {
+        const char* end = strchr(name, ',');
+        size_t length = end != NULL ? (size_t)(end - name) : strlen(name);
+
+        bool found = false;
+        for (int op = 0; op < 256; op++) {
+            const char* op_name = backend == BACKEND_REGISTER
+                ? reg_opcode_name((uint8_t)op)
+                : opcode_name((uint8_t)op);
+            if (op_name == NULL) continue;
+            if (strncmp(op_name, "OP_", 3) == 0) op_name += 3;
+
+            if (strlen(op_name) == length && strncmp(op_name, name, length) == 0) {
+                trace.ops[op] = true;
+                found = true;
+            }
+        }
+
+        if (!found) {
+            fprintf(stderr, "--trace-ops: unknown opcode '%.*s'.\n", (int)length, name);
+            return false;
+        }
+
+        name += length;
+        if (*name == ',') name++;
+    }
+
+    return true;
+};
+
+bool trace_start(VM_BACKEND backend) {
+    if (!trace.instructions && !trace.code) return true;
+    if (!resolve_ops(backend)) return false;
+
+    trace.out = stderr;
+    if (trace.path != NULL) {
+        trace.out = fopen(trace.path, "w");
+        if (trace.out == NULL) {
+            fprintf(stderr, "--trace-file: can't open '%s'.\n", trace.path);
+            return false;
+        }
+    }
+
+    setvbuf(trace.out, trace_buffer, _IOFBF, sizeof(trace_buffer));
+    debug_set_output(trace.out);
+    atexit(trace_flush);
+    return true;
+};
+
+void trace_flush() {
+    if (trace.out != NULL) fflush(trace.out);
+};
+
+static bool trace_filter(ObjFunction* function, uint8_t op) {
+    if (!trace.ops[op]) return false;
+
+    if (trace.function != NULL) {
+        const char* name = function->name != NULL ? function->name->chars : "<script>";
+        if (strcmp(name, trace.function) != 0) return false;
+    }
+
+    if (++trace.skipped < trace.rate) return false;
+    trace.skipped = 0;
+    return true;
+};
+
+static void trace_slots(Value* from) {
+    fprintf(trace.out, "       ");
+    for (Value* slot = from; slot < vm.stack_top; slot++) {
+        fprintf(trace.out, "[");
+        fprint_value(trace.out, *slot);
+        fprintf(trace.out, " ]");
+    }
+    fprintf(trace.out, "\n");
+};
+
+void trace_instruction(CallFrame* frame, uint8_t* ip) {
+    ObjFunction* function = get_frame_function(frame);
+    if (!trace_filter(function, *ip)) return;
+
+    trace_slots(vm.stack);
+    disassembleInstruction(&function->chunk, (int)(ip - function->chunk.code));
+};
+
+void trace_reg_instruction(CallFrame* frame, uint8_t* ip, Value* registers) {
+    ObjFunction* function = get_frame_function(frame);
+    if (!trace_filter(function, *ip)) return;
+
+    trace_slots(registers);
+    disassembleRegInstruction(function, (int)(ip - function->reg_chunk.code));
+};
+
+static bool has_quickened(Chunk* chunk) {
+    for (int offset = 0; offset < chunk->count; offset += chunk_instruction_length(chunk, offset)) {
+        if (chunk_generic_op(chunk->code[offset]) != chunk->code[offset]) return true;
+    }
+
+    return false;
+};
+
+void trace_quickened(ObjFunction* script) {
+    Chunk* chunk = &script->chunk;
+    if (has_quickened(chunk)) {
+        char title[128];
+        snprintf(title, sizeof(title), "%s (quickened)",
+                 script->name != NULL ? script->name->chars : "<script>");
+        disassembleChunk(chunk, title);
+    }
+
+    // nested functions are constants.
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_OBJ(constant) && OBJ_TYPE(constant) == OBJ_FUNCTION) {
+            trace_quickened(AS_FUNCTION(constant));
+        }
+    }
+};
@@ -0,0 +1,55 @@
+#ifndef CVM_TRACE_H
+#define CVM_TRACE_H
+
+#include "common.h"
+#include "vm.h"
+
+/*
+    Runtime tracing, debug build only (Makefile PROFILE=debug).
+    Off until enabled by main options:
+        --trace             every executed instruction: frame stack + disassembly
+        --trace-code        chunks dump after compile, and after the run for
+                            functions run() quickened (chunk.h)
+        --trace-fn=NAME     only instructions of function NAME (<script> - top level)
+        --trace-ops=A,B     only these opcodes, disassembler names without OP_
+        --trace-rate=N      every N-th instruction that passed the filters
+        --trace-file=PATH   sink, stderr by default
+
+    Sink is a fully buffered FILE (TRACE_BUFFER_SIZE), flushed at exit and
+    before runtime errors. Release build (PROFILE=release) has no
+    DEBUG_TRACE_EXECUTION / DEBUG_PRINT_CODE, nothing of it is in run().
+    Settings and sink are process-wide, meant for a single running isolate.
+*/
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    bool instructions;
+    bool code;
+    const char* function; // NULL - any
+    const char* ops_spec; // NULL - any opcode
+    bool ops[256]; // resolved ops_spec for the backend
+    uint32_t rate;
+    uint32_t skipped;
+    const char* path; // NULL - stderr
+    FILE* out;
+} Trace;
+
+extern Trace trace;
+
+// parse one --trace* option, false if it's not one or value is bad.
+bool trace_option(const char* arg);
+
+// open sink and resolve filters for `backend`, after options are parsed.
+bool trace_start(VM_BACKEND backend);
+
+void trace_flush();
+
+// dump functions of `script` holding quickened instructions.
+void trace_quickened(ObjFunction* script);
+
+// called from run() / reg_run() when trace.instructions is set.
+void trace_instruction(CallFrame* frame, uint8_t* ip);
+void trace_reg_instruction(CallFrame* frame, uint8_t* ip, Value* registers);
+
+#endif
@@ -4,16 +4,73 @@
 #include "common.h"
 #include "memory.h"
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+#ifdef NAN_BOXING
+
+#include "string.h"
+
+/*
+    NaN-boxing: every value is one 64-bit word.
+    - number: any double that is not a quiet NaN with QNAN bits set.
+    - null/false/true: QNAN + small tag in the lowest bits.
+    - obj: SIGN_BIT + QNAN + 48-bit pointer.
+*/
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL  1 // 01
+#define TAG_FALSE 2 // 10
+#define TAG_TRUE  3 // 11
+#define TAG_UNDEFINED 4 // 100
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_NULL(value) ((value) == NULL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_OBJ(value) \
+    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define BOOL_VAl(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(value) number_to_value(value)
+#define NULL_VAL ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define OBJ_VAL(object) \
+    (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJ(value) \
+    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+static inline double value_to_number(Value v) {
+    double number;
+    memcpy(&number, &v, sizeof(Value));
+    return number;
+}
+
+static inline Value number_to_value(double number) {
+    Value v;
+    memcpy(&v, &number, sizeof(double));
+    return v;
+}
+
+#else
+
 typedef enum {
     VALUE_BOOL,
     VALUE_NUMBER,
     VALUE_NULL,
     VALUE_OBJ,
+    VALUE_UNDEFINED, // vm internal: global slot without value
 } ValueType;
 
-typedef struct Obj Obj;
-typedef struct ObjString ObjString;
-
 typedef struct {
     ValueType type;
     union {
@@ -27,18 +84,24 @@ typedef struct {
 #define IS_NUMBER(value) ((value).type == VALUE_NUMBER)
 #define IS_NULL(value) ((value).type == VALUE_NULL)
 #define IS_OBJ(value) ((value).type == VALUE_OBJ)
-#define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
-#define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
-#define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
+#define IS_UNDEFINED(value) ((value).type == VALUE_UNDEFINED)
 
 #define BOOL_VAl(value) ((Value){VALUE_BOOL, {.boolean = value}}) 
 #define NUMBER_VAL(value) ((Value){VALUE_NUMBER, {.number = value}}) 
 #define NULL_VAL ((Value){VALUE_NULL, {.number = 0}}) 
+#define UNDEFINED_VAL ((Value){VALUE_UNDEFINED, {.number = 0}})
 #define OBJ_VAL(object) ((Value){VALUE_OBJ, {.obj = (Obj*)object}}) 
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJ(value) ((value).as.obj)
+
+#endif
+
+#define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
+#define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
+#define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
+
 #define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value))->function)
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
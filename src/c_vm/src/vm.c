@@ -2,11 +2,15 @@
 #include "compiler.h"
 #include "stdarg.h"
 #include "object.h"
+#include "gc.h"
+#include "profiler.h"
+#include "regvm.h"
+#include "trace.h"
 
 #include "builtin_natives/clock.h"
 #include "builtin_natives/math.h"
 
-VM vm;
+_Thread_local VM* vm_current = NULL;
 
 Value stack_peek(int distance) {
     return vm.stack_top[-1 - distance];
@@ -19,10 +23,16 @@ ObjFunction* get_frame_function(CallFrame* frame) {
     else if (frame->function->type == OBJ_CLOSURE) {
         return ((ObjClosure*)frame->function)->function;
     }
+
+    return NULL;
 };
 
+// frames printed from each end of a runtime error stack trace.
+#define VM_TRACE_FRAMES 16
+
 void runtime_error(const char* format, ...) {
     printf("\n");
+    trace_flush();
     fprintf(stderr, "--------- Runtime error ---------\n");
     va_list args;
     va_start(args, format);
@@ -30,12 +40,18 @@ void runtime_error(const char* format, ...) {
     va_end(args);
     fputs("\n", stderr);
 
-    // stack trace
+    // stack trace, deep ones without the middle part.
     for (int i = vm.frames_count - 1; i >= 0; i--) {
+        if (i == vm.frames_count - 1 - VM_TRACE_FRAMES && i >= VM_TRACE_FRAMES) {
+            fprintf(stderr, "[... %d frames]\n", i - VM_TRACE_FRAMES + 1);
+            i = VM_TRACE_FRAMES - 1;
+        }
+
         CallFrame* frame = &vm.frames[i];
         ObjFunction* func = get_frame_function(frame);
-        size_t instr = frame->ip - func->chunk.code - 1;
-        int line = func->chunk.lines[instr];
+        Chunk* chunk = vm.backend == BACKEND_REGISTER ? &func->reg_chunk : &func->chunk;
+        size_t instr = frame->ip - chunk->code - 1;
+        int line = chunk->lines[instr];
         ObjFunction* fn = func;
         fprintf(stderr, "[line %d] in %s\n", line, (fn->name != NULL ? fn->name->chars : "script"));
     }
@@ -43,10 +59,31 @@ void runtime_error(const char* format, ...) {
     vm_reset_stack();
 };
 
+// slot of global variable, new names get an undefined slot.
+int vm_global_slot(ObjString* name) {
+    Value index;
+    if (hashtable_get(&vm.globals, name, &index)) {
+        return (int)AS_NUMBER(index);
+    }
+
+    // keep name reachable while arrays grow.
+    vm_stack_push(OBJ_VAL(name));
+    int slot = vm.global_values.count;
+    valueArray_write(&vm.global_values, UNDEFINED_VAL);
+    valueArray_write(&vm.global_names, OBJ_VAL(name));
+    hashtable_set(&vm.globals, name, NUMBER_VAL((double)slot));
+    vm_stack_pop();
+
+    if (name->obj.is_young) vm.globals_has_young = true;
+    return slot;
+};
+
 void define_native(const char* name, NativeFn function) {
     vm_stack_push(OBJ_VAL(copy_string(name, (int)strlen(name))));
     vm_stack_push(OBJ_VAL(new_native(function)));
-    hashtable_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = vm_global_slot(AS_STRING(vm.stack[0]));
+    vm.global_values.values[slot] = vm.stack[1];
+    if (GC_IS_YOUNG_VALUE(vm.stack[1])) vm.globals_has_young = true;
     vm_stack_pop();
     vm_stack_pop();
 };
@@ -64,7 +101,33 @@ bool strings_equal(ObjString* a, ObjString* b) {
     return false;
 }
 
+static int text_length(Value v) {
+    return IS_ROPE(v) ? AS_ROPE(v)->length : AS_STRING(v)->length;
+};
+
+static ObjString* text_flatten(Value v) {
+    return IS_ROPE(v) ? rope_flatten(AS_ROPE(v)) : AS_STRING(v);
+};
+
+// a rope is equal to its interned flat string. both stay reachable
+// by the caller, flattening allocates.
+static bool texts_equal(Value a, Value b) {
+    if (!IS_TEXT(a) || !IS_TEXT(b)) return false;
+    if (text_length(a) != text_length(b)) return false;
+
+    ObjString* flat_a = text_flatten(a);
+    return flat_a == text_flatten(b);
+};
+
 bool valuesEqual(Value a, Value b) {
+    #ifdef NAN_BOXING
+    // NaN != NaN, everything else is equal by bits.
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    if (a == b) return true;
+    return (IS_ROPE(a) || IS_ROPE(b)) && texts_equal(a, b);
+    #else
     if (a.type != b.type) {
         return false;
     }
@@ -74,24 +137,40 @@ bool valuesEqual(Value a, Value b) {
     case VALUE_BOOL: return AS_BOOL(a) == AS_BOOL(b);
     case VALUE_NULL: return true;
     case VALUE_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-    case VALUE_OBJ: return AS_OBJ(a) == AS_OBJ(b); // cmp by ptr
+    case VALUE_OBJ:
+        if (AS_OBJ(a) == AS_OBJ(b)) return true; // cmp by ptr
+        return (IS_ROPE(a) || IS_ROPE(b)) && texts_equal(a, b);
     
     default:
         return false;
     }
+    #endif
 };
 
-ObjString* strings_concat() {
-    ObjString* b = AS_STRING(vm_stack_pop());
-    ObjString* a = AS_STRING(vm_stack_pop());
-    int len = a->length + b->length;
-    char* chars = ALLOCATE(char, len + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[len] = '\0';
-
-    ObjString* str = new_string(chars, len);
-    return str;
+// operands stay on stack until result is ready: allocation may run gc.
+// long results are ropes, flattened only when compared.
+Value strings_concat() {
+    Value b = stack_peek(0);
+    Value a = stack_peek(1);
+    int len = text_length(a) + text_length(b);
+
+    Value result;
+    if (len < ROPE_MIN_LENGTH) {
+        // ropes are never that short: both are flat strings.
+        ObjString* sa = AS_STRING(a);
+        ObjString* sb = AS_STRING(b);
+        char* chars = ALLOCATE(char, len + 1);
+        memcpy(chars, sa->chars, sa->length);
+        memcpy(chars + sa->length, sb->chars, sb->length);
+        chars[len] = '\0';
+        result = OBJ_VAL(new_string(chars, len));
+    } else {
+        result = OBJ_VAL(new_rope(AS_OBJ(a), AS_OBJ(b), len));
+    }
+
+    vm_stack_pop();
+    vm_stack_pop();
+    return result;
 };
 
 // call closure
@@ -105,8 +184,15 @@ static bool vm_call_func(Obj* callee, ObjFunction* function, int argCount) {
     return false;
   }
 
-  if (vm.frames_count == VM_FRAMES_MAX) {
-    runtime_error("Stack overflow.");
+  if (!vm_frames_ensure()) {
+    runtime_error("Stack overflow: more than %d frames.", VM_FRAMES_MAX);
+    return false;
+  }
+
+  // frame's pushes are covered here, run() doesn't check them.
+  int base = (int)(vm.stack_top - vm.stack) - argCount - 1;
+  if (!vm_stack_ensure(base + function->max_slots + VM_STACK_EXTRA)) {
+    runtime_error("Stack overflow: more than %d values.", VM_STACK_MAX);
     return false;
   }
 
@@ -114,7 +200,7 @@ static bool vm_call_func(Obj* callee, ObjFunction* function, int argCount) {
   frame->function = (Obj*)callee;
   frame->ip = function->chunk.code;
 
-  frame->slots = vm.stack_top - argCount - 1;
+  frame->slots = vm.stack + base;
   return true;
 }
 
@@ -165,6 +251,29 @@ bool call_value(Value callee, int argCount) {
     return false;
 };
 
+// `return f(...)`: callee and args slide down over the current frame,
+// which is reused for the call. Natives and bad calls go the
+// call_value way, OP_RET after the tail call returns their result.
+bool tail_call_value(int argCount) {
+    Value* callee = vm.stack_top - argCount - 1;
+    ObjFunction* function = NULL;
+    if (IS_OBJ(*callee) && OBJ_TYPE(*callee) == OBJ_CLOSURE) {
+        function = AS_CLOSURE(*callee)->function;
+    } else if (IS_OBJ(*callee) && OBJ_TYPE(*callee) == OBJ_FUNCTION) {
+        function = AS_FUNCTION(*callee);
+    }
+    if (function == NULL || function->arity != argCount) {
+        return call_value(*callee, argCount);
+    }
+
+    CallFrame* frame = &vm.frames[vm.frames_count - 1];
+    close_copy_upvalues(frame->slots);
+    memmove(frame->slots, callee, sizeof(Value) * (argCount + 1));
+    vm.stack_top = frame->slots + argCount + 1;
+    vm.frames_count--;
+    return call_value(frame->slots[0], argCount);
+};
+
 ObjUpvalue* capture_upvalue(Value* local) {
     // lookup for this upvalue.
     ObjUpvalue* prev= NULL;
@@ -195,6 +304,7 @@ void close_copy_upvalues(Value* last) {
         ObjUpvalue* upv = vm.open_upvalues;
         upv->closed = *upv->location;
         upv->location = &upv->closed;
+        GC_WRITE_BARRIER(upv, upv->closed);
         vm.open_upvalues  = upv->next;
     }
 }
@@ -210,49 +320,153 @@ INTERPRET_RESULT run() {
     #define READ_BYTE() (*ip++)
     #define READ_CONSTANT() (get_frame_function(frame)->chunk.constants.values[READ_BYTE()])
     #define READ_STRING() AS_STRING(READ_CONSTANT())
+    #define GLOBAL_NAME(slot) AS_STRING(vm.global_names.values[slot])
+    // numbers only, string concat is OP_ADD's slow path.
     #define BINARY_OP(valueType, operation) \
-        do {\
-            if (IS_STRING(stack_peek(0)) && IS_STRING(stack_peek(1))) { \
+        do { \
+            Value b = stack_peek(0); \
+            Value a = stack_peek(1); \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
                 frame->ip = ip; \
-                vm_stack_push(OBJ_VAL(strings_concat())); \
-                break; \
+                runtime_error("Operands must be numbers in BinaryOp."); \
+                return INTERPRET_RUNTIME_ERROR; \
             } \
-            \
-            if (!IS_NUMBER(stack_peek(0)) || !IS_NUMBER(stack_peek(1))) { \
+            vm.stack_top--; \
+            vm.stack_top[-1] = valueType(AS_NUMBER(a) operation AS_NUMBER(b)); \
+        } while (false)
+
+    // LESS followed by JUMP_IF_FALSE, nothing is left on stack.
+    #define LESS_JUMP_IF_FALSE(a, b) \
+        do { \
+            uint16_t offset = READ_SHORT(); \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
                 frame->ip = ip; \
                 runtime_error("Operands must be numbers in BinaryOp."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
-            double b = AS_NUMBER(vm_stack_pop()); \
-            double a = AS_NUMBER(vm_stack_pop()); \
-            vm_stack_push(valueType(a operation b)); \
-        } while (false) \
-
-    printf("-------- Runtime log ---------\n");
-
+            if (!(AS_NUMBER(a) < AS_NUMBER(b))) ip += offset; \
+        } while (false)
+
+    #define CLOSURE_FUNCTION(value) (AS_CLOSURE(value)->function)
+
+    // quickened OP_CALL: callee's frame is pushed right here, no
+    // call_value dispatch. Growing frames or stack is left to call_value,
+    // another callee type or arity turns it back into OP_CALL.
+    #define QUICK_CALL(objType, functionOf) \
+        do { \
+            int arg_count = READ_BYTE(); \
+            frame->ip = ip; \
+            PROFILER_SAFEPOINT(frame, ip); \
+            GC_SAFEPOINT(); \
+            \
+            /* after the safepoint: minor gc moves young objects. */ \
+            Value callee = stack_peek(arg_count); \
+            if (!IS_OBJ(callee) || OBJ_TYPE(callee) != objType || \
+                functionOf(callee)->arity != arg_count) { \
+                ip[-2] = OP_CALL; \
+                ip -= 2; \
+                break; \
+            } \
+            \
+            ObjFunction* function = functionOf(callee); \
+            Value* slots = vm.stack_top - arg_count - 1; \
+            if (vm.frames_count < vm.frames_capacity && \
+                slots + function->max_slots + VM_STACK_EXTRA <= vm.stack + vm.stack_capacity) { \
+                frame = &vm.frames[vm.frames_count++]; \
+                frame->function = AS_OBJ(callee); \
+                frame->ip = function->chunk.code; \
+                frame->slots = slots; \
+            } else if (!call_value(callee, arg_count)) { \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            frame = &vm.frames[vm.frames_count - 1]; \
+            ip = frame->ip; \
+        } while (false)
+
+    #ifdef DEBUG_TRACE_EXECUTION
+    // dump stack and instruction before executing it (trace.h).
+    #define TRACE_INSTRUCTION() \
+        do { \
+            if (trace.instructions) trace_instruction(frame, ip); \
+        } while (false)
+    #else
+    #define TRACE_INSTRUCTION() do {} while (false)
+    #endif
+
+    /*
+        Dispatch.
+        VM_COMPUTED_GOTO: every handler jumps straight to the next one
+        through the label table, so each opcode gets its own indirect
+        branch (better prediction, no switch bounds check).
+        Otherwise: portable switch inside a loop.
+    */
+    #ifdef VM_COMPUTED_GOTO
+    static void* dispatch_table[OP_CODE_COUNT] = {
+        [OP_RET] = &&L_OP_RET,
+        [OP_CONST] = &&L_OP_CONST,
+        [OP_NEGATE] = &&L_OP_NEGATE,
+        [OP_ADD] = &&L_OP_ADD,
+        [OP_SUB] = &&L_OP_SUB,
+        [OP_MUL] = &&L_OP_MUL,
+        [OP_DIV] = &&L_OP_DIV,
+        [OP_NULL] = &&L_OP_NULL,
+        [OP_TRUE] = &&L_OP_TRUE,
+        [OP_FALSE] = &&L_OP_FALSE,
+        [OP_NOT] = &&L_OP_NOT,
+        [OP_EQUAL] = &&L_OP_EQUAL,
+        [OP_GREATER] = &&L_OP_GREATER,
+        [OP_LESS] = &&L_OP_LESS,
+        [OP_PRINT] = &&L_OP_PRINT,
+        [OP_POP] = &&L_OP_POP,
+        [OP_DEFINE_GLOBAL] = &&L_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&L_OP_SET_GLOBAL,
+        [OP_GET_GLOBAL] = &&L_OP_GET_GLOBAL,
+        [OP_SET_LOCAL] = &&L_OP_SET_LOCAL,
+        [OP_GET_LOCAL] = &&L_OP_GET_LOCAL,
+        [OP_JUMP_IF_FALSE] = &&L_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&L_OP_JUMP_IF_TRUE,
+        [OP_JUMP] = &&L_OP_JUMP,
+        [OP_LOOP] = &&L_OP_LOOP,
+        [OP_DUP] = &&L_OP_DUP,
+        [OP_CALL] = &&L_OP_CALL,
+        [OP_TAIL_CALL] = &&L_OP_TAIL_CALL,
+        [OP_CLOSURE] = &&L_OP_CLOSURE,
+        [OP_GET_UPVALUE] = &&L_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&L_OP_SET_UPVALUE,
+        [OP_CLOSE_UPVALUE] = &&L_OP_CLOSE_UPVALUE,
+        [OP_ADD_LOCAL_CONST] = &&L_OP_ADD_LOCAL_CONST,
+        [OP_SET_LOCAL_POP] = &&L_OP_SET_LOCAL_POP,
+        [OP_LESS_LOCALS_JUMP_IF_FALSE] = &&L_OP_LESS_LOCALS_JUMP_IF_FALSE,
+        [OP_LESS_LOCAL_CONST_JUMP_IF_FALSE] = &&L_OP_LESS_LOCAL_CONST_JUMP_IF_FALSE,
+        [OP_ADD_NUM] = &&L_OP_ADD_NUM,
+        [OP_CALL_CLOSURE] = &&L_OP_CALL_CLOSURE,
+        [OP_CALL_FUNCTION] = &&L_OP_CALL_FUNCTION,
+    };
+
+    #define DISPATCH() \
+        do { \
+            TRACE_INSTRUCTION(); \
+            COUNT_INSTRUCTION(); \
+            goto *dispatch_table[READ_BYTE()]; \
+        } while (false)
+    #define VM_CASE(op) L_##op:
+    #define VM_NEXT() DISPATCH()
+    #else
+    #define VM_CASE(op) case op:
+    #define VM_NEXT() break
+    #endif
+
+    #ifdef VM_COMPUTED_GOTO
+    DISPATCH();
+    #else
     for (;;) {
-
-        #ifdef DEBUG_TRACE_EXECUTION
-
-        // dump stack each instruction
-        printf("       ");
-        for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
-            printf("[");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-
-        ObjFunction* fn = get_frame_function(frame);
-        disassembleInstruction(&fn->chunk, (int)(ip - fn->chunk.code));
-        #endif
-
-        uint8_t code; 
-        switch (code = READ_BYTE())
-        {
-        case OP_RET:
-            //printf("_______________OP RET, frame=%i, frame=%p func=%p frameCount=%i\n",  *(frame->ip), frame, frame->function, vm.frames_count);
-
+        TRACE_INSTRUCTION();
+        COUNT_INSTRUCTION();
+        switch (READ_BYTE())
+    #endif
+    {
+        VM_CASE(OP_RET) {
             // get return value.
             // clear stack args
             // push returned value on top of the stack.
@@ -272,10 +486,10 @@ INTERPRET_RESULT run() {
             // set frame to previous.
             frame = &vm.frames[vm.frames_count - 1];
             ip = frame->ip;
-            break;
+            VM_NEXT();
+        }
 
-        case OP_NEGATE: 
-            // vm_stack_push(-vm_stack_pop()); break;
+        VM_CASE(OP_NEGATE)
             if (!IS_NUMBER(stack_peek(0))) {
                 frame->ip = ip;
                 runtime_error("Operand must be a number.");
@@ -283,133 +497,214 @@ INTERPRET_RESULT run() {
             }
 
             vm_stack_push(NUMBER_VAL(-AS_NUMBER(vm_stack_pop())));
-            break;
-
-        case OP_ADD: BINARY_OP(NUMBER_VAL, +); break;
-        case OP_SUB: BINARY_OP(NUMBER_VAL, -); break;
-        case OP_MUL: BINARY_OP(NUMBER_VAL, *); break;
-        case OP_DIV: BINARY_OP(NUMBER_VAL, /); break;
-
-        case OP_CONST:
-            Value constant = READ_CONSTANT();
-            vm_stack_push(constant);
-            break; 
-
-        case OP_NULL: vm_stack_push(NULL_VAL); break;
-        case OP_TRUE: vm_stack_push(BOOL_VAl(true)); break;
-        case OP_FALSE: vm_stack_push(BOOL_VAl(false)); break;
+            VM_NEXT();
+
+        // numbers quicken the site into OP_ADD_NUM, strings concat.
+        VM_CASE(OP_ADD) {
+            Value b = stack_peek(0);
+            Value a = stack_peek(1);
+            if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                ip[-1] = OP_ADD_NUM;
+                vm.stack_top--;
+                vm.stack_top[-1] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+                VM_NEXT();
+            }
 
-        case OP_NOT: 
-            vm_stack_push(BOOL_VAl(bool_is_falsey(vm_stack_pop()))); 
-            break;
+            if (!IS_TEXT(a) || !IS_TEXT(b)) {
+                frame->ip = ip;
+                runtime_error("Operands must be numbers in BinaryOp.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            frame->ip = ip;
+            vm_stack_push(strings_concat());
+            VM_NEXT();
+        }
 
-        case OP_EQUAL:
-            Value a = vm_stack_pop();
-            Value b = vm_stack_pop();
-            vm_stack_push(BOOL_VAl(valuesEqual(a, b)));
-            break;
+        // quickened OP_ADD: anything but numbers turns it back and re-runs.
+        VM_CASE(OP_ADD_NUM) {
+            Value b = stack_peek(0);
+            Value a = stack_peek(1);
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                ip[-1] = OP_ADD;
+                ip--;
+                VM_NEXT();
+            }
+            vm.stack_top--;
+            vm.stack_top[-1] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+            VM_NEXT();
+        }
+        VM_CASE(OP_SUB) BINARY_OP(NUMBER_VAL, -); VM_NEXT();
+        VM_CASE(OP_MUL) BINARY_OP(NUMBER_VAL, *); VM_NEXT();
+        VM_CASE(OP_DIV) BINARY_OP(NUMBER_VAL, /); VM_NEXT();
+
+        VM_CASE(OP_CONST)
+            vm_stack_push(READ_CONSTANT());
+            VM_NEXT();
+
+        VM_CASE(OP_NULL) vm_stack_push(NULL_VAL); VM_NEXT();
+        VM_CASE(OP_TRUE) vm_stack_push(BOOL_VAl(true)); VM_NEXT();
+        VM_CASE(OP_FALSE) vm_stack_push(BOOL_VAl(false)); VM_NEXT();
+
+        VM_CASE(OP_NOT)
+            vm_stack_push(BOOL_VAl(bool_is_falsey(vm_stack_pop())));
+            VM_NEXT();
+
+        VM_CASE(OP_EQUAL) {
+            // operands stay rooted: comparing ropes flattens them.
+            bool equal = valuesEqual(stack_peek(1), stack_peek(0));
+            vm.stack_top--;
+            vm.stack_top[-1] = BOOL_VAl(equal);
+            VM_NEXT();
+        }
 
-        case OP_LESS: BINARY_OP(BOOL_VAl, <); break;
-        case OP_GREATER: BINARY_OP(BOOL_VAl, >); break;
+        VM_CASE(OP_LESS) BINARY_OP(BOOL_VAl, <); VM_NEXT();
+        VM_CASE(OP_GREATER) BINARY_OP(BOOL_VAl, >); VM_NEXT();
 
         // statements
-        case OP_PRINT:
-            print_value(vm_stack_pop());
-            printf("\n");
-            break;
-
-        case OP_DEFINE_GLOBAL:
-            //printf(":OP_DEFINE_GLOBAL\n");
-            ObjString* name = READ_STRING();
-            hashtable_set(&vm.globals, name, stack_peek(0));
-            vm_stack_pop();
-            break;
+        VM_CASE(OP_PRINT)
+            print_line(vm_stack_pop());
+            VM_NEXT();
+
+        // globals: operand is a slot in vm.global_values.
+        VM_CASE(OP_DEFINE_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            Value value = vm_stack_pop();
+            vm.global_values.values[slot] = value;
+            if (GC_IS_YOUNG_VALUE(value)) vm.globals_has_young = true;
+            VM_NEXT();
+        }
 
-        case OP_SET_GLOBAL:
-            ObjString* glob_name = READ_STRING();
-            if (hashtable_set(&vm.globals, glob_name, stack_peek(0))) {
+        VM_CASE(OP_SET_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            Value* global = &vm.global_values.values[slot];
+            if (IS_UNDEFINED(*global)) {
                 frame->ip = ip;
-                hashtable_delete(&vm.globals, glob_name); // [delete]
-                runtime_error("Undefined variable '%s'.", glob_name->chars);
+                runtime_error("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
 
-        case OP_GET_GLOBAL:
-            ObjString* get_glob_name = READ_STRING();
-            Value value;
-            if (!hashtable_get(&vm.globals, get_glob_name, &value)) {
+            *global = stack_peek(0);
+            if (GC_IS_YOUNG_VALUE(*global)) vm.globals_has_young = true;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_GET_GLOBAL) {
+            uint16_t slot = READ_SHORT();
+            Value value = vm.global_values.values[slot];
+            if (IS_UNDEFINED(value)) {
                 frame->ip = ip;
-                runtime_error("Undefined variable '%s'.", get_glob_name->chars);
+                runtime_error("Undefined variable '%s'.", GLOBAL_NAME(slot)->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            
+
             vm_stack_push(value);
-            break;
+            VM_NEXT();
+        }
 
-        case OP_POP: vm_stack_pop(); break;
+        VM_CASE(OP_POP) vm_stack_pop(); VM_NEXT();
 
-        case OP_SET_LOCAL:
-            uint8_t set_slot = READ_BYTE();
-            frame->slots[set_slot] = stack_peek(0);
-            break;
+        VM_CASE(OP_SET_LOCAL) {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = stack_peek(0);
+            VM_NEXT();
+        }
 
-        case OP_GET_LOCAL:
-            uint8_t get_slot = READ_BYTE();
-            vm_stack_push(frame->slots[get_slot]);
-            break;
+        VM_CASE(OP_GET_LOCAL) {
+            uint8_t slot = READ_BYTE();
+            vm_stack_push(frame->slots[slot]);
+            VM_NEXT();
+        }
 
-        case OP_JUMP_IF_FALSE:
-            uint16_t offset_if_false = READ_SHORT();
-            if (bool_is_falsey(stack_peek(0))) ip += offset_if_false;
-            break;
+        VM_CASE(OP_JUMP_IF_FALSE) {
+            uint16_t offset = READ_SHORT();
+            if (bool_is_falsey(stack_peek(0))) ip += offset;
+            VM_NEXT();
+        }
 
-        case OP_JUMP:
-            uint8_t offset_jump = READ_SHORT();
-            ip += offset_jump;
-            break;
+        VM_CASE(OP_JUMP_IF_TRUE) {
+            uint16_t offset = READ_SHORT();
+            if (!bool_is_falsey(stack_peek(0))) ip += offset;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_JUMP) {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            VM_NEXT();
+        }
 
-        case OP_LOOP: 
-            uint16_t offset_loop = READ_SHORT();
+        VM_CASE(OP_LOOP) {
+            uint16_t offset = READ_SHORT();
+            PROFILER_SAFEPOINT(frame, ip);
             // go back to loop condition
-            ip -= offset_loop;
-            break;
+            ip -= offset;
+            GC_SAFEPOINT();
+            VM_NEXT();
+        }
 
-        case OP_DUP: vm_stack_push(stack_peek(0)); break;
+        VM_CASE(OP_DUP) vm_stack_push(stack_peek(0)); VM_NEXT();
 
-        case OP_CALL:
+        VM_CASE(OP_CALL) {
             // stack now: ..., fn, args.., argCount, OP_CALL
             int arg_count = READ_BYTE();
-            
+
             frame->ip = ip;
+            PROFILER_SAFEPOINT(frame, ip);
+            GC_SAFEPOINT();
 
-            if (!call_value(stack_peek(arg_count), arg_count)) {
+            Value callee = stack_peek(arg_count);
+            if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_CLOSURE) ip[-2] = OP_CALL_CLOSURE;
+            if (IS_OBJ(callee) && OBJ_TYPE(callee) == OBJ_FUNCTION) ip[-2] = OP_CALL_FUNCTION;
+            if (!call_value(callee, arg_count)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
 
             // update frame on new function.
             frame = &vm.frames[vm.frames_count - 1];
             ip = frame->ip;
-            break;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_CALL_CLOSURE) QUICK_CALL(OBJ_CLOSURE, CLOSURE_FUNCTION); VM_NEXT();
+        VM_CASE(OP_CALL_FUNCTION) QUICK_CALL(OBJ_FUNCTION, AS_FUNCTION); VM_NEXT();
 
+        VM_CASE(OP_TAIL_CALL) {
+            int arg_count = READ_BYTE();
+
+            frame->ip = ip;
+            PROFILER_SAFEPOINT(frame, ip);
+            GC_SAFEPOINT();
 
-        case OP_GET_UPVALUE:
+            if (!tail_call_value(arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            // same frame, callee's code.
+            frame = &vm.frames[vm.frames_count - 1];
+            ip = frame->ip;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_GET_UPVALUE) {
             uint8_t slot = READ_BYTE();
-            
             vm_stack_push(*((ObjClosure*)frame->function)->upvalues[slot]->location);
-            break;
+            VM_NEXT();
+        }
 
-        case OP_SET_UPVALUE:
-            uint8_t slot_set = READ_BYTE();
-            *((ObjClosure*)frame->function)->upvalues[slot]->location = stack_peek(0);
-            break;
+        VM_CASE(OP_SET_UPVALUE) {
+            uint8_t slot = READ_BYTE();
+            ObjUpvalue* upv = ((ObjClosure*)frame->function)->upvalues[slot];
+            *upv->location = stack_peek(0);
+            GC_WRITE_BARRIER(upv, stack_peek(0));
+            VM_NEXT();
+        }
 
-        case OP_CLOSE_UPVALUE:
+        VM_CASE(OP_CLOSE_UPVALUE)
             close_copy_upvalues(vm.stack_top-1);
             vm_stack_pop();
-            break;
+            VM_NEXT();
 
-        case OP_CLOSURE:
+        VM_CASE(OP_CLOSURE) {
             ObjFunction* func = AS_FUNCTION(READ_CONSTANT());
             ObjClosure* closure = new_closure(func);
             vm_stack_push(OBJ_VAL(closure));
@@ -425,37 +720,88 @@ INTERPRET_RESULT run() {
                     // take from parent..
                     closure->upvalues[i] = ((ObjClosure*)frame->function)->upvalues[upv_index];
                 }
+                GC_WRITE_BARRIER(closure, OBJ_VAL(closure->upvalues[i]));
             }
 
-            break;
+            VM_NEXT();
+        }
 
+        // ---- superinstructions
+        VM_CASE(OP_ADD_LOCAL_CONST) {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT(); // always a number
+            if (!IS_NUMBER(a)) {
+                frame->ip = ip;
+                runtime_error("Operands must be numbers in BinaryOp.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            vm_stack_push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_SET_LOCAL_POP) {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = vm_stack_pop();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LESS_LOCALS_JUMP_IF_FALSE) {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = frame->slots[READ_BYTE()];
+            LESS_JUMP_IF_FALSE(a, b);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LESS_LOCAL_CONST_JUMP_IF_FALSE) {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            LESS_JUMP_IF_FALSE(a, b);
+            VM_NEXT();
+        }
+
+    #ifndef VM_COMPUTED_GOTO
         default:
-            break;
+            VM_NEXT();
         }
+    #endif
     }
 
+    #ifdef VM_COMPUTED_GOTO
+    #undef DISPATCH
+    #endif
+    #undef VM_CASE
+    #undef VM_NEXT
+    #undef TRACE_INSTRUCTION
+    #undef BINARY_OP
+    #undef LESS_JUMP_IF_FALSE
+    #undef QUICK_CALL
+    #undef CLOSURE_FUNCTION
+    #undef GLOBAL_NAME
     #undef READ_STRING
     #undef READ_BYTE
     #undef READ_CONSTANT
     #undef READ_SHORT
 };
 
-INTERPRET_RESULT vm_interpret_source(const char* source) {
-    ObjFunction* function = compile(source);
-    if (function  == NULL) {
-        return INTERPRET_COMPILE_ERROR;
-    }
-
+INTERPRET_RESULT vm_interpret_function(ObjFunction* function) {
     // set MAIN function at top frame to run 
     vm_stack_push(OBJ_VAL(function));
     ObjClosure* closure = new_closure(function);
     vm_stack_pop();
     vm_stack_push(OBJ_VAL(closure));
 
+    if (vm.backend == BACKEND_REGISTER) return reg_interpret();
+
     // set initialy function.
     call_closure(closure, 0);
 
-    return run();
+    INTERPRET_RESULT result = run();
+    #ifdef DEBUG_PRINT_CODE
+    // code as quickening left it.
+    if (trace.code) trace_quickened(function);
+    #endif
+    return result;
 };
 
 /*
@@ -484,6 +830,47 @@ Value vm_stack_pop() {
     return *vm.stack_top;
 };
 
+bool vm_stack_ensure(int slots) {
+    if (slots <= vm.stack_capacity) return true;
+    if (slots > VM_STACK_MAX) return false;
+
+    int capacity = vm.stack_capacity;
+    while (capacity < slots) capacity *= 2;
+    if (capacity > VM_STACK_MAX) capacity = VM_STACK_MAX;
+
+    // new buffer and copy: old pointers stay valid until rebased.
+    Value* stack = (Value*)malloc(sizeof(Value) * capacity);
+    if (stack == NULL) exit(1);
+    memcpy(stack, vm.stack, sizeof(Value) * (vm.stack_top - vm.stack));
+
+    vm.stack_top = stack + (vm.stack_top - vm.stack);
+    for (int i = 0; i < vm.frames_count; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    }
+    for (ObjUpvalue* upv = vm.open_upvalues; upv != NULL; upv = upv->next) {
+        upv->location = stack + (upv->location - vm.stack);
+    }
+
+    free(vm.stack);
+    vm.stack = stack;
+    vm.stack_capacity = capacity;
+    return true;
+};
+
+bool vm_frames_ensure() {
+    if (vm.frames_count < vm.frames_capacity) return true;
+    if (vm.frames_capacity >= VM_FRAMES_MAX) return false;
+
+    int capacity = vm.frames_capacity * 2;
+    if (capacity > VM_FRAMES_MAX) capacity = VM_FRAMES_MAX;
+
+    CallFrame* frames = (CallFrame*)realloc(vm.frames, sizeof(CallFrame) * capacity);
+    if (frames == NULL) exit(1);
+    vm.frames = frames;
+    vm.frames_capacity = capacity;
+    return true;
+};
+
 // --------- VM
 
 void vm_add_natives() {
@@ -492,11 +879,36 @@ void vm_add_natives() {
     define_native("min", _min);
 };
 
+void vm_reset_globals() {
+    vm_reset_stack();
+    for (int i = 0; i < vm.global_values.count; i++) {
+        vm.global_values.values[i] = UNDEFINED_VAL;
+    }
+    vm_add_natives();
+};
+
 void vm_init() {
+    vm.stack = (Value*)malloc(sizeof(Value) * VM_STACK_INITIAL);
+    vm.stack_capacity = VM_STACK_INITIAL;
+    vm.frames = (CallFrame*)malloc(sizeof(CallFrame) * VM_FRAMES_INITIAL);
+    vm.frames_capacity = VM_FRAMES_INITIAL;
+    if (vm.stack == NULL || vm.frames == NULL) exit(1);
     vm_reset_stack();
+    vm.backend = BACKEND_STACK;
+    vm.use_cache = false;
+    vm.instruction_count = 0;
     vm.objects = NULL;
+    vm.bytes_allocated = 0;
+    vm.next_gc = GC_INITIAL_NEXT;
+    vm.gray_count = 0;
+    vm.gray_capacity = 0;
+    vm.gray_stack = NULL;
+    gc_nursery_init();
     hashtable_init(&vm.strings);
     hashtable_init(&vm.globals);
+    valueArray_init(&vm.global_values, 64);
+    valueArray_init(&vm.global_names, 64);
+    vm.globals_has_young = false;
 
     // add globals
     vm_add_natives();
@@ -504,6 +916,8 @@ void vm_init() {
 
 
 void vm_destroy() {
+    gc_nursery_destroy();
+
     Obj* t = vm.objects;
     while (t != NULL) {
         Obj* next = t->next;
@@ -513,5 +927,15 @@ void vm_destroy() {
 
     destroy_hashtable(&vm.strings);
     destroy_hashtable(&vm.globals);
-    //FREE(Hashtable, vm.strings);
+    valueArray_destroy(&vm.global_values);
+    valueArray_destroy(&vm.global_names);
+    free(vm.gray_stack);
+    free(vm.stack);
+    free(vm.frames);
+    vm.stack = NULL;
+    vm.frames = NULL;
+
+    #ifdef VM_STATS
+    fprintf(stderr, "-- instructions: %llu\n", (unsigned long long)vm.instruction_count);
+    #endif
 };
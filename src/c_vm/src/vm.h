@@ -4,16 +4,33 @@
 #include "tools/hashtable.h"
 #include "chunk.h"
 #include "debug.h"
+#include "cvm.h"
 
+// value stack and frames grow on demand up to hard limits
+// (Makefile: STACK_MAX, FRAMES_MAX). Stack is reserved on call for
+// function's max_slots, pushes inside a frame need no checks.
+#ifndef VM_STACK_MAX
+#define VM_STACK_MAX (1024 * 1024)
+#endif
+#ifndef VM_FRAMES_MAX
+#define VM_FRAMES_MAX (64 * 1024)
+#endif
+#define VM_STACK_INITIAL 256
+#define VM_FRAMES_INITIAL 64
+// room above max_slots: native results, string concat, gc roots.
+#define VM_STACK_EXTRA 8
 
 typedef enum {
-    INTERPRET_OK,
-    INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
-} INTERPRET_RESULT;
+    BACKEND_STACK,
+    BACKEND_REGISTER, // regvm.h
+} VM_BACKEND;
 
-#define VM_STACK_MAX 256
-#define VM_FRAMES_MAX 64
+// count executed instructions (Makefile: STATS=1).
+#ifdef VM_STATS
+#define COUNT_INSTRUCTION() (vm.instruction_count++)
+#else
+#define COUNT_INSTRUCTION() do {} while (false)
+#endif
 
 typedef struct {
     Obj* function;
@@ -23,29 +40,84 @@ typedef struct {
     Value* slots; // stack
  } CallFrame;
 
-typedef struct {
-    CallFrame frames[VM_FRAMES_MAX];
+struct VM {
+    VM_BACKEND backend;
+    bool use_cache;
+    uint64_t instruction_count;
+    CallFrame* frames;
     int frames_count;
+    int frames_capacity;
     //Chunk* chunk;
     //uint8_t* instr_ptr;
     // --- stack ----
-    Value stack[VM_STACK_MAX];
+    Value* stack;
     Value* stack_top;
+    int stack_capacity;
     Obj* objects;
+    // ---- gc ----
+    size_t bytes_allocated;
+    size_t next_gc;
+    int gray_count;
+    int gray_capacity;
+    Obj** gray_stack;
+    uint8_t* nursery;
+    uint8_t* nursery_top;
+    uint8_t* nursery_end;
+    bool nursery_full;
+    Obj** remembered;
+    int remembered_count;
+    int remembered_capacity;
     // ---- strings ----
     Hashtable strings;
+    // ---- globals ----
+    // resolved at compile time: name -> slot index.
     Hashtable globals;
+    ValueArray global_values; // UNDEFINED_VAL until defined
+    ValueArray global_names;
+    bool globals_has_young; // write barrier for global arrays
     // ----- upvalues ---
     ObjUpvalue* open_upvalues;
-} VM;
+};
 
-extern VM vm;
+// isolate the calling thread works on, bound by cvm_* (cvm.h).
+// all of vm/gc/object code goes through `vm`.
+#ifdef __cplusplus
+// C++ front ends emitting bytecode include vm headers too.
+extern thread_local VM* vm_current;
+#else
+extern _Thread_local VM* vm_current;
+#endif
+#define vm (*vm_current)
 
 void vm_init();
 void vm_destroy();
-INTERPRET_RESULT vm_interpret_source(const char* source);
+// run compiled script (compile() or cache_load()), cvm_run binds the isolate.
+INTERPRET_RESULT vm_interpret_function(ObjFunction* function);
+
+int vm_global_slot(ObjString* name);
+
+// shared by both backends.
+void runtime_error(const char* format, ...);
+ObjFunction* get_frame_function(CallFrame* frame);
+bool call_value(Value callee, int argCount);
+bool tail_call_value(int argCount);
+ObjUpvalue* capture_upvalue(Value* local);
+void close_copy_upvalues(Value* last);
+Value strings_concat();
 
+bool bool_is_falsey(Value v);
+bool valuesEqual(Value a, Value b);
+
+void vm_reset_stack();
+// undefine all script globals and define natives again, slots and heap stay.
+void vm_reset_globals();
 void vm_stack_push(Value v);
 Value vm_stack_pop();
 
+// stack holds at least `slots` values from vm.stack, moving it rebases
+// frame slots and open upvalues. false past VM_STACK_MAX.
+bool vm_stack_ensure(int slots);
+// room for one more call frame, false past VM_FRAMES_MAX.
+bool vm_frames_ensure();
+
 #endif
\ No newline at end of file
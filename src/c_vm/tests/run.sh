@@ -0,0 +1,73 @@
+#!/bin/bash
+# usage: run.sh [--cached] [-u] <vm binary> [vm options...]
+# runs every tests/*.lan and compares with tests/*.out: stdout, "rc=N"
+# with the exit code, then stderr. --cached runs each script twice with
+# the bytecode cache on, the second run loads the .lanc the first wrote.
+# -u: rewrite the .out files from this run instead of comparing.
+
+CACHED=0
+UPDATE=0
+for arg in "$@"; do
+    case "$arg" in
+        --cached) CACHED=1 ;;
+        -u) UPDATE=1 ;;
+        *) break ;;
+    esac
+    shift
+done
+
+VM=$1
+shift
+DIR=$(dirname "$0")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+run() {
+    "$VM" "$@" >"$WORK/stdout" 2>"$WORK/stderr"
+    local rc=$?
+    cat "$WORK/stdout"
+    echo "rc=$rc"
+    cat "$WORK/stderr"
+}
+
+failed=0
+for test in "$DIR"/*.lan; do
+    name=$(basename "$test" .lan)
+    expected="$DIR/$name.out"
+
+    if [ $CACHED = 1 ]; then
+        # cache is written beside the script: run a copy.
+        cp "$test" "$WORK/$name.lan"
+        run "$@" "$WORK/$name.lan" >"$WORK/compiled"
+        run "$@" "$WORK/$name.lan" >"$WORK/actual"
+        if [ ! -f "$WORK/${name}.lanc" ]; then
+            echo "FAIL $name: no cache written"
+            failed=$((failed + 1))
+            continue
+        fi
+        if ! cmp -s "$WORK/compiled" "$WORK/actual"; then
+            echo "FAIL $name: cached run differs"
+            diff "$WORK/compiled" "$WORK/actual" | head -10
+            failed=$((failed + 1))
+            continue
+        fi
+    else
+        run "$@" "$test" >"$WORK/actual"
+    fi
+
+    if [ $UPDATE = 1 ]; then
+        cp "$WORK/actual" "$expected"
+    elif ! cmp -s "$expected" "$WORK/actual"; then
+        echo "FAIL $name"
+        diff "$expected" "$WORK/actual" | head -10
+        failed=$((failed + 1))
+    fi
+done
+
+mode="$VM${*:+ $*}"
+[ $CACHED = 1 ] && mode="$mode (cached)"
+if [ $failed -gt 0 ]; then
+    echo "$mode: $failed failed"
+    exit 1
+fi
+echo "$mode: ok"
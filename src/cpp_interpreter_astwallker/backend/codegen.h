@@ -0,0 +1,400 @@
+#pragma once
+#include "../expr/expr.h"
+#include "../scan/token.h"
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../../c_vm/src/vm.h"
+#include "../../c_vm/src/gc.h"
+#include "../../c_vm/src/object.h"
+#include "../../c_vm/src/optimizer.h"
+}
+
+using namespace std;
+
+// Lowers the resolved tree to c_vm bytecode: one script function, run by
+// the stack vm instead of Interpreter. Uses Resolver's slots:
+// program scope - vm globals, blocks - stack slots of the script frame.
+// Every variable of a block is pushed as null at block entry, as
+// Interpreter sizes an Environment, so a declaration under `if`/`while`
+// (their bodies are not blocks) keeps the stack balanced.
+class CodeGen : IVisitor<ReturnObject> {
+    private:
+    ObjFunction* _function;
+    int _line;
+    // stack slot of the first variable of every open block, innermost last.
+    vector<int> _bases;
+    int _locals; // slot 0 is the script closure
+    // literal -> constant index: one chunk holds 256 constants.
+    map<double, int> _numbers;
+    map<string, int> _strings;
+    vector<string> errors;
+
+    void error(const char* msg, Token* name) {
+        string s(msg);
+        if (name) {
+            s.append(" '");
+            s.append(name->get_lex());
+            s.append("'");
+        }
+        errors.push_back(s);
+    }
+
+    Chunk* chunk() {
+        return &_function->chunk;
+    }
+
+    void at(Token* t) {
+        if (t) _line = t->get_line();
+    }
+
+    void emit_byte(uint8_t byte) {
+        chunk_write(chunk(), byte, _line);
+    }
+
+    void emit_bytes(uint8_t byte1, uint8_t byte2) {
+        emit_byte(byte1);
+        emit_byte(byte2);
+    }
+
+    void emit_op_short(uint8_t op, uint16_t operand) {
+        emit_byte(op);
+        emit_byte((operand >> 8) & 0xff);
+        emit_byte(operand & 0xff);
+    }
+
+    int make_constant(Value value) {
+        int index = chunk_add_constant(chunk(), value);
+        GC_WRITE_BARRIER(_function, value);
+        if (index > UINT8_MAX) {
+            error("Too many constants in one chunk.", NULL);
+            return 0;
+        }
+
+        return index;
+    }
+
+    void emit_number(double number) {
+        auto found = _numbers.find(number);
+        int index = found != end(_numbers)
+            ? found->second
+            : _numbers[number] = make_constant(NUMBER_VAL(number));
+        emit_bytes(OP_CONST, (uint8_t)index);
+    }
+
+    void emit_string(const string& chars) {
+        auto found = _strings.find(chars);
+        int index = found != end(_strings)
+            ? found->second
+            : _strings[chars] = make_constant(OBJ_VAL(copy_string(chars.c_str(), (int)chars.size())));
+        emit_bytes(OP_CONST, (uint8_t)index);
+    }
+
+    int emit_jump(uint8_t op) {
+        emit_byte(op);
+        emit_byte(0xff);
+        emit_byte(0xff);
+        return chunk()->count - 2;
+    }
+
+    void patch_jump(int offset) {
+        int jump = chunk()->count - offset - 2;
+        if (jump > UINT16_MAX) error("Too much code to jump over.", NULL);
+
+        chunk()->code[offset] = (jump >> 8) & 0xff;
+        chunk()->code[offset + 1] = jump & 0xff;
+    }
+
+    void emit_loop(int start) {
+        emit_byte(OP_LOOP);
+        int offset = chunk()->count - start + 2;
+        if (offset > UINT16_MAX) error("While loop body too large.", NULL);
+
+        emit_byte((offset >> 8) & 0xff);
+        emit_byte(offset & 0xff);
+    }
+
+    uint16_t global_slot(Token* name) {
+        string lex = name->get_lex();
+        int slot = vm_global_slot(copy_string(lex.c_str(), (int)lex.size()));
+        if (slot > UINT16_MAX) {
+            error("Too many global variables.", name);
+            return 0;
+        }
+
+        return (uint16_t)slot;
+    }
+
+    // (depth, slot) as Resolver set them, depth reaching the program
+    // scope - a global.
+    void emit_variable(bool set, Token* name, int depth, int slot) {
+        int scope = (int)_bases.size() - depth;
+        if (scope == 0) {
+            emit_op_short(set ? OP_SET_GLOBAL : OP_GET_GLOBAL, global_slot(name));
+            return;
+        }
+
+        emit_bytes(set ? OP_SET_LOCAL : OP_GET_LOCAL, (uint8_t)(_bases[scope - 1] + slot));
+    }
+
+    void emit_store(Token* name, int depth, int slot) {
+        emit_variable(true, name, depth, slot);
+        emit_byte(OP_POP);
+    }
+
+    // program-scope variables are defined (null) before the first
+    // statement runs, like the program Environment of Interpreter.
+    void define_globals(Statement* s) {
+        if (!s) return;
+
+        Token* name = NULL;
+        if (s->varDecl) name = s->varDecl->name;
+        else if (s->varDefine) name = s->varDefine->name;
+        else if (s->_if) {
+            define_globals(s->_if->then);
+            define_globals(s->_if->els);
+        }
+        else if (s->_while) define_globals(s->_while->then);
+
+        if (name) {
+            emit_byte(OP_NULL);
+            emit_op_short(OP_DEFINE_GLOBAL, global_slot(name));
+        }
+    }
+
+    void generate(Expr* expr) {
+        if (expr) expr->inerpret(*this);
+    }
+
+    ReturnObject visit_binary(Binary* t) {
+        if (t->oper->get_type() == COMMA) {
+            generate(t->left);
+            emit_byte(OP_POP);
+            generate(t->right);
+            return VoidType();
+        }
+
+        generate(t->left);
+        generate(t->right);
+        at(t->oper);
+        switch (t->oper->get_type())
+        {
+        case PLUS: emit_byte(OP_ADD); break;
+        case MINUS: emit_byte(OP_SUB); break;
+        case STAR: emit_byte(OP_MUL); break;
+        case SLASH: emit_byte(OP_DIV); break;
+        case EQ_EQ: emit_byte(OP_EQUAL); break;
+        case NOT_EQ: emit_bytes(OP_EQUAL, OP_NOT); break;
+        case LESS: emit_byte(OP_LESS); break;
+        case GREATER: emit_byte(OP_GREATER); break;
+        case LESS_EQ: emit_bytes(OP_GREATER, OP_NOT); break;
+        case GREATER_EQ: emit_bytes(OP_LESS, OP_NOT); break;
+
+        default:
+            error("Unsupported binary operator.", t->oper);
+        }
+
+        return VoidType();
+    }
+
+    ReturnObject visit_grouping(Grouping* t) {
+        generate(t->expr);
+        return VoidType();
+    }
+
+    ReturnObject visit_unary(Unary* t) {
+        generate(t->expr);
+        at(t->oper);
+        switch (t->oper->get_type())
+        {
+        case MINUS: emit_byte(OP_NEGATE); break;
+        case EXCL: emit_byte(OP_NOT); break;
+
+        default:
+            error("Unsupported unary operator.", t->oper);
+        }
+
+        return VoidType();
+    }
+
+    ReturnObject visit_literal(Literal* t) {
+        at(t->token);
+        switch (t->token->get_type())
+        {
+        case LITERAL_INT: emit_number(strtod(t->token->get_lex().c_str(), NULL)); break;
+        case LITERAL_STRING: emit_string(t->token->get_lex()); break;
+
+        case BOOL_TRUE: emit_byte(OP_TRUE); break;
+        case BOOL_FALSE: emit_byte(OP_FALSE); break;
+        case NONE: emit_byte(OP_NULL); break;
+
+        default:
+            error("Unsupported literal.", t->token);
+        }
+
+        return VoidType();
+    }
+
+    ReturnObject visit_id(Identifier* t) {
+        at(t->token);
+        emit_variable(false, t->token, t->depth, t->slot);
+        return VoidType();
+    }
+
+    ReturnObject visit_conditional(Conditional* t) {
+        generate(t->cond);
+        int else_jump = emit_jump(OP_JUMP_IF_FALSE);
+        emit_byte(OP_POP);
+        generate(t->then);
+
+        int end_jump = emit_jump(OP_JUMP);
+        patch_jump(else_jump);
+        emit_byte(OP_POP);
+        generate(t->els);
+        patch_jump(end_jump);
+        return VoidType();
+    }
+
+    // short-circuit, the value of the last evaluated operand.
+    ReturnObject visit_logical(Logical* l) {
+        generate(l->lhs);
+        at(l->oper);
+        int jump = emit_jump(l->oper->get_type() == OR ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE);
+        emit_byte(OP_POP);
+        generate(l->rhs);
+        patch_jump(jump);
+        return VoidType();
+    }
+
+    ReturnObject visit_func(Function* f) {
+        generate(f->callee);
+        for (auto &arg : f->args) generate(arg);
+
+        at(f->paren);
+        if (f->args.size() > UINT8_MAX) error("Too many call arguments.", f->paren);
+        emit_bytes(OP_CALL, (uint8_t)f->args.size());
+        return VoidType();
+    }
+
+    void generate_block(Block* block) {
+        int slots = (int)block->slots;
+        if (_locals + slots > UINT8_MAX + 1) {
+            error("Too many local variables in function.", NULL);
+            return;
+        }
+
+        _bases.push_back(_locals);
+        _locals += slots;
+        for (int i = 0; i < slots; i++) emit_byte(OP_NULL);
+
+        for (auto &state : block->statements) generate(state);
+
+        for (int i = 0; i < slots; i++) emit_byte(OP_POP);
+        _locals -= slots;
+        _bases.pop_back();
+    }
+
+    ReturnObject visit_statement(Statement* t) {
+        if (t->expression) {
+            generate(t->expression);
+            emit_byte(OP_POP);
+        }
+        else if (t->varDecl) {
+            generate(t->varDecl->initializer);
+            emit_store(t->varDecl->name, 0, t->varDecl->slot);
+        }
+        else if (t->varDefine) {
+            emit_byte(OP_NULL);
+            emit_store(t->varDefine->name, 0, t->varDefine->slot);
+        }
+        else if (t->varAssign) {
+            generate(t->varAssign->val);
+            emit_store(t->varAssign->name, t->varAssign->depth, t->varAssign->slot);
+        }
+        else if (t->block) generate_block(t->block);
+        else if (t->_while) {
+            int loop_start = chunk()->count;
+            generate(t->_while->cond);
+            int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
+            emit_byte(OP_POP);
+            generate(t->_while->then);
+            emit_loop(loop_start);
+
+            patch_jump(exit_jump);
+            emit_byte(OP_POP);
+        }
+        else if (t->_if) {
+            generate(t->_if->cond);
+            int then_jump = emit_jump(OP_JUMP_IF_FALSE);
+            emit_byte(OP_POP);
+            generate(t->_if->then);
+
+            int else_jump = emit_jump(OP_JUMP);
+            patch_jump(then_jump);
+            emit_byte(OP_POP);
+            generate(t->_if->els);
+            patch_jump(else_jump);
+        }
+        else if (t->print) {
+            generate(t->print);
+            emit_byte(OP_PRINT);
+        }
+
+        return VoidType();
+    }
+
+    // the function is on the vm stack while it is built: gc roots.
+    ObjFunction* generate_script(vector<Statement*>& program) {
+        _function = new_function();
+        vm_stack_push(OBJ_VAL(_function));
+
+        for (auto &st : program) define_globals(st);
+        for (auto &st : program) generate(st);
+
+        emit_byte(OP_NULL);
+        emit_byte(OP_RET);
+
+        #ifdef COMPILER_OPTIMIZE
+        if (good()) optimize_chunk(chunk());
+        #endif
+
+        if (good()) {
+            _function->max_slots = chunk_max_stack(chunk(), 1);
+            if (_function->max_slots < 0) error("Inconsistent stack depth.", NULL);
+        }
+
+        vm_stack_pop();
+        return _function;
+    }
+
+    public:
+    CodeGen() : _function(NULL), _line(0), _locals(1) {};
+
+    // binds `isolate` to the thread for the duration, as cvm_run does.
+    INTERPRET_RESULT run(VM* isolate, vector<Statement*>& program) {
+        VM* previous = vm_current;
+        vm_current = isolate;
+
+        ObjFunction* script = generate_script(program);
+        INTERPRET_RESULT result = good()
+            ? vm_interpret_function(script)
+            : INTERPRET_COMPILE_ERROR;
+
+        vm_current = previous;
+        return result;
+    }
+
+    bool good() {
+        return errors.empty();
+    }
+
+    void dump_errors() {
+        printf("Dump codegen errors:\n");
+        for (auto &e : errors) {
+            printf("error: '%s'\n", e.c_str());
+        }
+    }
+};
@@ -1,8 +1,7 @@
 #pragma once
 #include "../expr/expr.h"
 #include "../scan/token.h"
-#include  <boost/any.hpp>
-#include <boost/smart_ptr.hpp>
+#include <memory>
 #include <vector>
 #include "../backend/obj.h"
 
@@ -15,56 +14,19 @@ class RuntimeError {
     RuntimeError(string&& msg, int line): msg(msg), line(line) {};
 };
 
+// variables of one scope by Resolver slots; depth hops to enclosing ones.
 class Environment {
-    std::map<std::string, ReturnObject> vars;
-    
-    void var_set(string& name, ReturnObject& value) {
-        vars[name] = value;
-
-        string sv = obj::to_str(value);
-        printf("Env: [%s]=%s\n", name.c_str(), sv.c_str());
-    };
+    std::vector<ReturnObject> slots;
+    shared_ptr<Environment> enclosing;
 
     public:
+        Environment(size_t size, shared_ptr<Environment> enclosing)
+            : slots(size, NoneType()), enclosing(enclosing) {};
 
-        ReturnObject var_get(std::string& name) {
-            return vars[name];
-        };
-
-        bool var_contains(std::string& name) {
-            if (vars.find(name) != end(vars)) return true;
-            else return false;
-        };
-
-        bool var_assign(std::string& name, ReturnObject& v, string& error_msg) {
-            if (!var_contains(name)) {
-                error_msg = "Variable doesn't exist in this context.";
-                return false;
-            }
-
-            vars[name] = v;
-            return true;
-        };
-
-        bool var_decl(std::string& name, ReturnObject& v, string& error_msg) {
-            if (var_contains(name)) {
-                error_msg = "Variable already defined.";
-                return false;
-            }
-
-            vars[name] = v;
-            return true;
-        };
-
-        bool var_define(std::string& name, string& error_msg) {
-            if (var_contains(name)) {
-                error_msg = "Variable already defined.";
-                return false;
-            }
-
-            ReturnObject default_init = NoneType();
-            var_set(name, default_init);
-            return true;
+        ReturnObject& at(int depth, int slot) {
+            Environment* env = this;
+            for (; depth > 0; depth--) env = env->enclosing.get();
+            return env->slots[slot];
         };
 };
 
@@ -72,16 +34,17 @@ class Interpreter : IVisitor<ReturnObject> {
     private:
     bool _hadErrors;
     shared_ptr<Environment> _env;
+    StringTable& _strings;
     std::vector<unique_ptr<RuntimeError>> errors;
 
     ReturnObject resolve_token(Token* t) {
         switch (t->get_type())
         {
         case LITERAL_INT:
-            return std::stof(t->get_lex());
+            return (double)std::stof(t->get_lex());
         
         case LITERAL_STRING:
-            return t->get_lex();
+            return _strings.intern(t->get_lex());
         
         case NONE:
             return NoneType();
@@ -126,32 +89,17 @@ class Interpreter : IVisitor<ReturnObject> {
         }
     };
 
-    template<typename CheckType>
-    bool check_operand(ReturnObject t) {
-        CheckType te;
-        if (getVariant<CheckType>(t, te)) return true;
-        else return false;
-    }
-
-    template<typename CheckType>
-    bool is_type(initializer_list<ReturnObject> types) {
-        if (types.size() == 0) return false;
-        for (auto &tp : types) {
-            CheckType t;
-            if (!getVariant<CheckType>(tp, t)) return false;
-        }
-
-        return true;
-    }
-
     void runtime_erorr(const char* msg) {
         _hadErrors = true;
         errors.push_back(make_unique<RuntimeError>(msg, 0));
     }
 
     ReturnObject visit_literal(Literal* t) {
-        auto s = resolve_token(t->token);
-        return s;
+        if (!t->evaluated) {
+            t->value = resolve_token(t->token);
+            t->evaluated = true;
+        }
+        return t->value;
     };
 
     ReturnObject visit_grouping(Grouping* t) {
@@ -168,29 +116,25 @@ class Interpreter : IVisitor<ReturnObject> {
         {
         case TokenType::MINUS:
             // resolve type cast
-            if (!check_operand<double>(right))
+            if (!right.is_number())
             {
                 runtime_erorr("<Unary> right op can be type of Double");
                 return NoneType();
             }
 
-            double _double;
-            getVariant<double>(right, _double);
-            return -_double;
+            return -right.as_number();
 
         case TokenType::EXCL: // !
-            if (!check_operand<bool>(right))
+            if (!right.is_bool())
             {
                 runtime_erorr("<Unary> right op can be type of Bool");
                 return NoneType();
             }
             
-            bool _bool;
-            getVariant<bool>(right, _bool);
-            return !_bool;
+            return !right.as_bool();
 
         default:
-            if (!check_operand<bool>(right))
+            if (!right.is_bool())
             {
                 runtime_erorr("<Unary> Can't resolve type.");
                 return NoneType();
@@ -208,16 +152,14 @@ class Interpreter : IVisitor<ReturnObject> {
         // resolve types
         if (is_math_op(t->oper->get_type()))
         {
-            if (!check_operand<double>(l) || !check_operand<double>(r))
+            if (!l.is_number() || !r.is_number())
             {
                 runtime_erorr("<Binary> left and right operands should have Double type.");
                 return NoneType();
             }
 
-            double lr;
-            double rt;
-            getVariant<double>(l, lr);
-            getVariant<double>(r, rt);
+            double lr = l.as_number();
+            double rt = r.as_number();
 
             switch (t->oper->get_type())
             {
@@ -239,72 +181,14 @@ class Interpreter : IVisitor<ReturnObject> {
             }
         }
         if (is_logic_op(t->oper->get_type())) {
-            
-            // strings
-            // doubles
-            // bools
-
-            if (is_type<double>({l, r})) {
-                double left;
-                double right;
-                getVariant<double>(l, left);
-                getVariant<double>(r, right);
-
-                switch (t->oper->get_type())
-                {
-                case EQ_EQ:
-                    return bool(left == right);
-                
-                case NOT_EQ:
-                    return bool(left != right);
-
-                default:
-                    if (!check_operand<bool>(right))
-                        runtime_erorr("<Binary.logic.double> Can't resolve type.");
-                    return NoneType();
-                }
-            }
-            else if (is_type<std::string>({l, r})) {
-                std::string left;
-                std::string right;
-                getVariant<std::string>(l, left);
-                getVariant<std::string>(r, right);
-
-                switch (t->oper->get_type())
-                {
-                case EQ_EQ:
-                    return bool(left == right);
-                
-                case NOT_EQ:
-                    return bool(left != right);
-
-                default:
-                    if (!check_operand<bool>(right))
-                        runtime_erorr("<Binary.logic.string> Can't resolve type.");
-                    return NoneType();
-                }
-            }
-            else if (is_type<bool>({l, r})) {
-                bool left = boost::get<bool>(l);
-                bool right = boost::get<bool>(r);
-
-                switch (t->oper->get_type())
-                {
-                case EQ_EQ:
-                    return bool(left == right);
-                
-                case NOT_EQ:
-                    return bool(left != right);
-
-                default:
-                    if (!check_operand<bool>(right))
-                        runtime_erorr("<Binary.logic.bool> Can't resolve type.");
-                    return NoneType();
-                }
+            // strings, doubles, bools; both of one type
+            if (l.type() != r.type() || !(l.is_number() || l.is_string() || l.is_bool())) {
+                runtime_erorr("<Binary.logic.bool> Can't resolve logic op");
+                return NoneType();
             }
-            
-            runtime_erorr("<Binary.logic.bool> Can't resolve logic op");
-                return NoneType();        
+
+            bool equal = l.equals(r);
+            return t->oper->get_type() == EQ_EQ ? equal : !equal;
         }
 
         runtime_erorr("<Binary> Can't resolve Binary type.");
@@ -312,11 +196,7 @@ class Interpreter : IVisitor<ReturnObject> {
     }
 
     ReturnObject visit_id(Identifier* t) {
-        
-        string varname = t->token->get_lex();
-        ReturnObject val = _env.get()->var_get(varname);
-        
-        return val;
+        return _env->at(t->depth, t->slot);
     }
 
     ReturnObject visit_call(FunctionCall* t) {
@@ -324,13 +204,7 @@ class Interpreter : IVisitor<ReturnObject> {
     }
 
     bool is_true_logic(ReturnObject& t) {
-        if (check_operand<bool>(t)) {
-            bool _v;
-            getVariant(t, _v);
-            return _v;
-        }
-
-        return false;
+        return t.is_bool() && t.as_bool();
     }
 
     ReturnObject visit_logical(Logical* l) {
@@ -350,7 +224,7 @@ class Interpreter : IVisitor<ReturnObject> {
         return NoneType();
     }
 
-    void execute_block(Block* block, shared_ptr<Environment>&& env) {
+    void execute_block(Block* block, shared_ptr<Environment> env) {
         auto prev = this->_env;
         this->_env = env;
         for (auto &state : block->statements) {
@@ -362,13 +236,11 @@ class Interpreter : IVisitor<ReturnObject> {
     
     ReturnObject execute_if(IfBlock* b) {
         auto cond_v = b->cond->inerpret(*this);
-        if (!check_operand<bool>(cond_v)) {
+        if (!cond_v.is_bool()) {
             return VoidType();
         }
 
-        bool fact_v;
-        getVariant(cond_v, fact_v);
-        if (fact_v) {
+        if (cond_v.as_bool()) {
             auto ret_val = b->then->inerpret(*this);
             return ret_val;
         }
@@ -380,13 +252,13 @@ class Interpreter : IVisitor<ReturnObject> {
     }
 
     ReturnObject execute_while(WhileStatement* w) {
-        
         ReturnObject cond = w->cond->inerpret(*this);
         while(is_true_logic(cond)) {
             ReturnObject tv = w->then->inerpret(*this);
-            if (check_operand<BreakLoop>(tv)) {
+            if (tv.is_break()) {
                 break;
             }
+            cond = w->cond->inerpret(*this);
         }
 
         return VoidType();
@@ -398,40 +270,22 @@ class Interpreter : IVisitor<ReturnObject> {
 
     ReturnObject visit_statement(Statement* t) {
         if (t->expression) return t->expression->inerpret(*this);
+        // names are resolved already (Resolver), only slots here.
         else if (t->varDecl) {
-            string err;
-            string name = t->varDecl->name->get_lex();
-            ReturnObject retVal = t->varDecl->initializer->inerpret(*this);
-            if (!_env.get()->var_decl(name, retVal, err)) {
-                runtime_erorr(err.c_str());
-                return NoneType();
-            }
-
+            _env->at(0, t->varDecl->slot) = t->varDecl->initializer->inerpret(*this);
             return VoidType();
         }
         else if (t->varDefine) {
-            string err;
-            string name = t->varDefine->name->get_lex();
-            if (!_env.get()->var_define(name, err)) {
-                runtime_erorr(err.c_str());
-                return NoneType();
-            }
-
+            _env->at(0, t->varDefine->slot) = NoneType();
             return VoidType();
         }
         else if (t->varAssign) {
-            string err;
-            string name = t->varAssign->name->get_lex();
             ReturnObject retVal = t->varAssign->val->inerpret(*this);
-            if (!_env.get()->var_assign(name, retVal, err)) {
-                runtime_erorr(err.c_str());
-                return NoneType();
-            }
-
+            _env->at(t->varAssign->depth, t->varAssign->slot) = retVal;
             return VoidType();
         }
         else if (t->block) {
-            execute_block(t->block, make_shared<Environment>());
+            execute_block(t->block, make_shared<Environment>(t->block->slots, _env));
             return VoidType();
         }
         else if (t->_while) {
@@ -443,26 +297,20 @@ class Interpreter : IVisitor<ReturnObject> {
         else if (t->print) {
             printf("s.print\n");
             ReturnObject v = t->print->inerpret(*this);
-            if (check_operand<double>(v)) {
-                double _v;
-                getVariant<double>(v, _v);
-                printf("Print '%f'\n", _v);
+            if (v.is_number()) {
+                printf("Print '%f'\n", v.as_number());
             }
-            else if (check_operand<bool>(v)) {
-                bool _v;
-                getVariant<bool>(v, _v);
-                if (_v) printf("Print True\n");
+            else if (v.is_bool()) {
+                if (v.as_bool()) printf("Print True\n");
                 else printf("Print False\n");
             }
-            else if (check_operand<std::string>(v)) {
-                std::string _v;
-                getVariant<std::string>(v, _v);
-                printf("Print '%s'\n", _v.c_str());
+            else if (v.is_string()) {
+                printf("Print '%s'\n", v.as_string().c_str());
             }
-            else if (check_operand<NoneType>(v)) {
+            else if (v.is_none()) {
                 printf("Print None\n");
             }
-            else if (check_operand<BreakLoop>(v)) {
+            else if (v.is_break()) {
                 printf("Print BreakLoop\n");
             }
             else {
@@ -475,12 +323,17 @@ class Interpreter : IVisitor<ReturnObject> {
         else {
             runtime_erorr("Undefined statement to execute\n");
         }
+
+        return VoidType();
     }
 
     
 
     public:
-    Interpreter() : _hadErrors(false), _env(make_unique<Environment>()) {};
+    // globals: Resolver::global_slots() of the program to run,
+    // strings: the table of its unit.
+    Interpreter(size_t globals, StringTable& strings)
+        : _hadErrors(false), _env(make_shared<Environment>(globals, nullptr)), _strings(strings) {};
 
     void dump_errors() {
         printf("Dump runtime errors:\n");
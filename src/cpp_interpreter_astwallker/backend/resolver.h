@@ -0,0 +1,163 @@
+#pragma once
+#include "../expr/expr.h"
+#include "../scan/token.h"
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Static pass before Interpreter: gives every variable a slot in the
+// environment of its scope (program or block) and every use the number
+// of environments to go up to reach it. Interpreter creates exactly one
+// Environment per executed block, so (depth, slot) is an indexed load.
+class Resolver : IVisitor<ReturnObject> {
+    private:
+    // innermost last, [0] - program scope.
+    vector<map<string, int>> scopes;
+    vector<string> errors;
+
+    void error(const char* msg, Token* name) {
+        string s(msg);
+        s.append(" '");
+        s.append(name->get_lex());
+        s.append("'");
+        errors.push_back(s);
+    }
+
+    void resolve(Expr* expr) {
+        if (expr) expr->inerpret(*this);
+    }
+
+    int declare(Token* name) {
+        auto& scope = scopes.back();
+        if (scope.find(name->get_lex()) != end(scope)) {
+            error("Variable already defined.", name);
+            return scope[name->get_lex()];
+        }
+
+        int slot = (int)scope.size();
+        scope[name->get_lex()] = slot;
+        return slot;
+    }
+
+    // false if name is not declared in any enclosing scope.
+    bool lookup(Token* name, int& depth, int& slot) {
+        for (int i = (int)scopes.size() - 1; i >= 0; i--) {
+            auto found = scopes[i].find(name->get_lex());
+            if (found != end(scopes[i])) {
+                depth = (int)scopes.size() - 1 - i;
+                slot = found->second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    ReturnObject visit_binary(Binary* t) {
+        resolve(t->left);
+        resolve(t->right);
+        return VoidType();
+    }
+
+    ReturnObject visit_grouping(Grouping* t) {
+        resolve(t->expr);
+        return VoidType();
+    }
+
+    ReturnObject visit_unary(Unary* t) {
+        resolve(t->expr);
+        return VoidType();
+    }
+
+    ReturnObject visit_literal(Literal* t) {
+        return VoidType();
+    }
+
+    ReturnObject visit_id(Identifier* t) {
+        if (!lookup(t->token, t->depth, t->slot)) {
+            error("Undefined variable.", t->token);
+        }
+        return VoidType();
+    }
+
+    ReturnObject visit_conditional(Conditional* t) {
+        resolve(t->cond);
+        resolve(t->then);
+        resolve(t->els);
+        return VoidType();
+    }
+
+    ReturnObject visit_logical(Logical* t) {
+        resolve(t->lhs);
+        resolve(t->rhs);
+        return VoidType();
+    }
+
+    ReturnObject visit_func(Function* f) {
+        resolve(f->callee);
+        for (auto &arg : f->args) resolve(arg);
+        return VoidType();
+    }
+
+    ReturnObject visit_statement(Statement* t) {
+        if (t->expression) resolve(t->expression);
+        else if (t->varDecl) {
+            // initializer first: `var a = a;` reads the outer a.
+            resolve(t->varDecl->initializer);
+            t->varDecl->slot = declare(t->varDecl->name);
+        }
+        else if (t->varDefine) {
+            t->varDefine->slot = declare(t->varDefine->name);
+        }
+        else if (t->varAssign) {
+            resolve(t->varAssign->val);
+            VarAssign* a = t->varAssign;
+            if (!lookup(a->name, a->depth, a->slot)) {
+                error("Variable doesn't exist in this context.", a->name);
+            }
+        }
+        else if (t->block) {
+            scopes.emplace_back();
+            for (auto &state : t->block->statements) resolve(state);
+            t->block->slots = scopes.back().size();
+            scopes.pop_back();
+        }
+        else if (t->_while) {
+            resolve(t->_while->cond);
+            resolve(t->_while->then);
+        }
+        else if (t->_if) {
+            resolve(t->_if->cond);
+            resolve(t->_if->then);
+            resolve(t->_if->els);
+        }
+        else if (t->print) resolve(t->print);
+
+        return VoidType();
+    }
+
+    public:
+    Resolver() : scopes(1) {};
+
+    void resolve(vector<Statement*>& program) {
+        for (auto &st : program) resolve(st);
+    }
+
+    // size of the program environment.
+    size_t global_slots() {
+        return scopes[0].size();
+    }
+
+    bool good() {
+        return errors.empty();
+    }
+
+    void dump_errors() {
+        printf("Dump resolve errors:\n");
+        for (auto &e : errors) {
+            printf("error: '%s'\n", e.c_str());
+        }
+    }
+};
@@ -1,24 +1,9 @@
 #pragma once
 
-#include <boost/variant.hpp>
 #include <string>
+#include <vector>
 #include "../scan/token.h"
-#include <boost/optional.hpp>
-#include <boost/any.hpp>
-
-struct VoidType{};
-struct NoneType{};
-struct BreakLoop{};
-typedef boost::variant<NoneType, bool, double,  std::string, VoidType, BreakLoop> ReturnObject;
-
-template<typename CheckType>
-bool getVariant(const ReturnObject& v, CheckType& out) {
-    if (const CheckType* ptr = boost::get<CheckType>(&v)) {
-        out = *ptr;
-        return true;
-    }
-    return false;
-}
+#include "value.h"
 
 class Binary;
 class Grouping;
@@ -105,7 +90,11 @@ class Unary : public Expr {
 class Literal : public Expr {
     public:
         Token* token;
-        Literal(Token* tk) {
+        // Interpreter converts the lexeme once.
+        ReturnObject value;
+        bool evaluated;
+
+        Literal(Token* tk) : evaluated(false) {
             this->token = tk;
         };
 
@@ -121,8 +110,11 @@ class Literal : public Expr {
 class Identifier : public Expr {
     public:
         Token* token;
+        // set by Resolver: environments to go up, slot in that one.
+        int depth;
+        int slot;
 
-        Identifier(Token* tk) {
+        Identifier(Token* tk) : depth(-1), slot(-1) {
             this->token = tk;
         };
 
@@ -169,30 +161,36 @@ class Logical : public Expr {
     };
 };
 
+// slot/depth below are set by Resolver.
 class VarDecl {
     public:
     Token* name;
     Expr* initializer;
-    VarDecl(Token* t, Expr* init) : name(t), initializer(init) {};
+    int slot;
+    VarDecl(Token* t, Expr* init) : name(t), initializer(init), slot(-1) {};
 };
 
 class VarDefine {
     public:
     Token* name;
-    VarDefine(Token* t) : name(t) {};
+    int slot;
+    VarDefine(Token* t) : name(t), slot(-1) {};
 };
 
 class VarAssign {
     public:
     Token* name;
     Expr* val;
-    VarAssign(Token* t, Expr* init) : name(t), val(init) {};
+    int depth;
+    int slot;
+    VarAssign(Token* t, Expr* init) : name(t), val(init), depth(-1), slot(-1) {};
 };
 
 class Block {
     public:
     std::vector<Statement*> statements;
-    Block(std::vector<Statement*>& s) : statements(s) {};
+    size_t slots; // variables declared directly in the block
+    Block(std::vector<Statement*>& s) : statements(s), slots(0) {};
 };
 
 class IfBlock {
@@ -237,7 +235,7 @@ class Statement : public Expr {
         IfBlock* _if;
         WhileStatement* _while;
 
-        Statement() : _while(NULL), _if(NULL), expression(NULL), print(NULL), varDecl(NULL), varDefine(NULL), block(NULL) {};
+        Statement() : _while(NULL), _if(NULL), expression(NULL), print(NULL), varDecl(NULL), varDefine(NULL), varAssign(NULL), block(NULL) {};
 
         std::string accept(IVisitor<std::string>& v) {
             return v.visit_statement(this);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+struct VoidType{};
+struct NoneType{};
+struct BreakLoop{};
+
+// Runtime value of the tree walker: a tag and a 8-byte payload, 16 bytes,
+// trivially copyable. Strings are interned (StringTable), so values only
+// carry a pointer and equal strings are the same pointer.
+class ReturnObject {
+    public:
+    enum Type : uint8_t {
+        NONE,
+        BOOL,
+        NUMBER,
+        STRING,
+        VOID,
+        BREAK,
+    };
+
+    private:
+    Type _type;
+    union {
+        bool boolean;
+        double number;
+        const std::string* string;
+    } _as;
+
+    public:
+    ReturnObject() : _type(NONE) { _as.number = 0; };
+    ReturnObject(NoneType) : ReturnObject() {};
+    ReturnObject(VoidType) : _type(VOID) { _as.number = 0; };
+    ReturnObject(BreakLoop) : _type(BREAK) { _as.number = 0; };
+    ReturnObject(bool v) : _type(BOOL) { _as.boolean = v; };
+    ReturnObject(double v) : _type(NUMBER) { _as.number = v; };
+
+    // `interned` comes from StringTable::intern and lives as long as it.
+    static ReturnObject string(const std::string* interned) {
+        ReturnObject v;
+        v._type = STRING;
+        v._as.string = interned;
+        return v;
+    };
+
+    Type type() const { return _type; };
+    bool is_none() const { return _type == NONE; };
+    bool is_bool() const { return _type == BOOL; };
+    bool is_number() const { return _type == NUMBER; };
+    bool is_string() const { return _type == STRING; };
+    bool is_break() const { return _type == BREAK; };
+
+    bool as_bool() const { return _as.boolean; };
+    double as_number() const { return _as.number; };
+    const std::string& as_string() const { return *_as.string; };
+
+    // same type and value; interned strings compare by pointer.
+    bool equals(const ReturnObject& other) const {
+        if (_type != other._type) return false;
+        switch (_type)
+        {
+        case BOOL: return _as.boolean == other._as.boolean;
+        case NUMBER: return _as.number == other._as.number;
+        case STRING: return _as.string == other._as.string;
+        default: return true;
+        }
+    };
+};
+
+static_assert(sizeof(ReturnObject) == 16, "ReturnObject is a tag and a 8-byte payload");
+
+// Strings of one compilation unit, freed with it. Literal values cached
+// in the tree point here, so the table lives next to the unit's Arena.
+// No locking: a unit is run by one thread at a time.
+class StringTable {
+    private:
+    std::unordered_set<std::string> _strings;
+
+    public:
+    StringTable() {};
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+
+    ReturnObject intern(const std::string& chars) {
+        return ReturnObject::string(&*_strings.insert(chars).first);
+    };
+};
@@ -3,12 +3,17 @@
 #include <string>
 #include "scan/scanner.h"
 #include "tools/log.h"
+#include "tools/arena.h"
+#include "tools/mapped_file.h"
 #include "expr/expr.h"
 #include "tools/ast_printer.h"
 #include "tools/prn_visitor.h"
 #include "tools/token_print.h"
 #include "parse/parser.h"
+#include "backend/resolver.h"
 #include "backend/interpreter.h"
+#include "backend/codegen.h"
+#include "../c_vm/src/cvm.h"
 #include "backend/obj.h"
 
 namespace opt = boost::program_options;
@@ -17,16 +22,35 @@ using namespace std;
 
 int main(int argc, char* argv[]) {
     opt::options_description desc("All options");
+    desc.add_options()
+        ("vm", "run as c_vm bytecode instead of the tree walker")
+        ("file", opt::value<string>()->default_value("/home/gcreep/github.local/lang-cpp/src/test.txt"),
+            "script to run");
+
+    // tt [--vm] [file]
+    opt::positional_options_description pos;
+    pos.add("file", 1);
+
+    opt::variables_map opt_map;
+    opt::store(opt::command_line_parser(argc, argv).options(desc).positional(pos).run(), opt_map);
+    opt::notify(opt_map);
 
     Scanner sc;
-    string src = sc.read_file("/home/gcreep/github.local/lang-cpp/src/test.txt");
+    MappedFile src(opt_map["file"].as<string>().c_str());
+    if (!src.good()) {
+        printf("Can't open source file.\n");
+        return 2;
+    }
     
-    printf("src='%s'\n", src.c_str());
+    printf("src='%.*s'\n", (int)src.size(), src.data());
 
-    auto toks = sc.get_tokens(src);
+    // tokens and tree live until the end of main, tokens point into src.
+    Arena unit;
+    StringTable strings;
+    auto toks = sc.get_tokens(src.data(), src.size(), unit);
     tools::print_tokens(toks, cout, ' ');
 
-    Parser ps(toks);
+    Parser ps(toks, unit);
 
     vector<Statement*> ex = ps.parse();
     AstPrinter as;
@@ -35,7 +59,26 @@ int main(int argc, char* argv[]) {
 
     printf("has %i\n", ex.size());
 
-    Interpreter pt;
+    Resolver rs;
+    rs.resolve(ex);
+    if (!rs.good()) {
+        rs.dump_errors();
+        return 65;
+    }
+
+    if (opt_map.count("vm")) {
+        CodeGen gen;
+        VM* isolate = cvm_new(NULL);
+        INTERPRET_RESULT result = gen.run(isolate, ex);
+        cvm_free(isolate);
+
+        if (!gen.good()) gen.dump_errors();
+        if (result == INTERPRET_COMPILE_ERROR) return 65;
+        if (result == INTERPRET_RUNTIME_ERROR) return 70;
+        return 0;
+    }
+
+    Interpreter pt(rs.global_slots(), strings);
     pt.interpete(ex);
     pt.dump_errors();
 
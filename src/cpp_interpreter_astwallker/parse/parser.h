@@ -5,10 +5,12 @@
 #include "../scan/token.h"
 #include <initializer_list>
 #include "../tools/log.h"
+#include "../tools/arena.h"
 
 class Parser {
     private:
     std::vector<Token*> _tokens;
+    Arena& _arena; // owns every node parse() makes
     size_t _currentPos;
     size_t _endPos;
     
@@ -144,16 +146,16 @@ class Parser {
                     if (match({TokenType::SEMICOLON})) {
                         move_next();
                     
-                        Statement* s = new Statement();
-                        s->varDecl = new VarDecl(name, init);
+                        Statement* s = _arena.make<Statement>();
+                        s->varDecl = _arena.make<VarDecl>(name, init);
                         return s;
                     }
                 }
                 else if (match({TokenType::SEMICOLON})) {
                     move_next();
 
-                    Statement* s = new Statement();
-                    s->varDefine = new VarDefine(name);
+                    Statement* s = _arena.make<Statement>();
+                    s->varDefine = _arena.make<VarDefine>(name);
                     return s;
                 }
             }
@@ -172,7 +174,7 @@ class Parser {
 
             if (match({TokenType::SEMICOLON})) {
                 move_next();
-                Statement* s= new Statement();
+                Statement* s= _arena.make<Statement>();
                 s->print = ex;
                 return s;
             }
@@ -187,7 +189,7 @@ class Parser {
             Token* oper = current();
             move_next();
             Expr* rhs = logicAnd();
-            logic = new Logical(logic, rhs, oper);
+            logic = _arena.make<Logical>(logic, rhs, oper);
         }
 
         return logic;
@@ -199,7 +201,7 @@ class Parser {
             Token* oper = current();
             move_next();
             Expr* rhs = equality();
-            logic = new Logical(logic, rhs, oper);
+            logic = _arena.make<Logical>(logic, rhs, oper);
         }
 
         return logic;
@@ -219,8 +221,8 @@ class Parser {
                 if (match({TokenType::SEMICOLON})) {
                     move_next();
 
-                    Statement* s = new Statement();
-                    s->varAssign = new VarAssign(id, rhs);
+                    Statement* s = _arena.make<Statement>();
+                    s->varAssign = _arena.make<VarAssign>(id, rhs);
                     return s;
                 }
             }
@@ -237,7 +239,7 @@ class Parser {
 
         if (match({TokenType::SEMICOLON})) {
             move_next();
-            Statement* s=  new Statement();
+            Statement* s=  _arena.make<Statement>();
             s->expression = ex;
             return s;
         }
@@ -262,8 +264,8 @@ class Parser {
             }
 
             move_next();
-            Statement* state = new Statement();
-            state->block = new Block(st);
+            Statement* state = _arena.make<Statement>();
+            state->block = _arena.make<Block>(st);
             return state;
         }
 
@@ -288,8 +290,8 @@ class Parser {
                 }
 
                 if (match({TokenType::RIGHT_FIG_BR})) {
-                    Statement* w = new Statement();
-                    w->_while = new WhileStatement(cond, st);
+                    Statement* w = _arena.make<Statement>();
+                    w->_while = _arena.make<WhileStatement>(cond, st);
                     return w;
                 }
             }
@@ -333,8 +335,8 @@ class Parser {
             }
 
             move_next();
-            Statement* s = new Statement();
-            s->_if = new IfBlock(cond, then, NULL);
+            Statement* s = _arena.make<Statement>();
+            s->_if = _arena.make<IfBlock>(cond, then, nullptr);
             
             // parsing else
             if (match({TokenType::ELSE, TokenType::LEFT_FIG_BR})) {
@@ -402,7 +404,7 @@ class Parser {
                     return NULL;
                 }
 
-                return new Conditional(left, els, then);
+                return _arena.make<Conditional>(left, els, then);
             }
 
             printf("Can't parse  structure <conditional>\n");
@@ -423,7 +425,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <comma>\n")) {
                 return NULL;
             }
-            return new Binary(left, right, op);
+            return _arena.make<Binary>(left, right, op);
         }
 
         return left;
@@ -439,7 +441,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <equality>\n")) {
                 return NULL;
             }
-            return new Binary(left, right, op);
+            return _arena.make<Binary>(left, right, op);
         }
 
         return left;
@@ -456,7 +458,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <comparison>\n")) {
                 return NULL;
             }
-            return new Binary(left, right, op);
+            return _arena.make<Binary>(left, right, op);
         }
 
         return left;
@@ -471,7 +473,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <term>\n")) {
                 return NULL;
             }
-            return new Binary(left, right, op);
+            return _arena.make<Binary>(left, right, op);
         }
         
         return left;
@@ -487,7 +489,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <factor>\n")) {
                 return NULL;
             }
-            return new Binary(left, right, op);
+            return _arena.make<Binary>(left, right, op);
         }
 
         return left;
@@ -515,7 +517,7 @@ class Parser {
         if (match({TokenType::RIGHT_ROUND_BR})) {
             Token* cur = current();
             move_next();
-            return new Function(callee, cur, a);
+            return _arena.make<Function>(callee, cur, a);
         }
 
         Lang::Log(ERROR, "Expect close arguments ')' in func.\n");
@@ -544,7 +546,7 @@ class Parser {
             if (!verify(right, "Expected right expression in <unary>\n")) {
                 return NULL;
             }
-            return new Unary(right, op);
+            return _arena.make<Unary>(right, op);
         }
 
         return call();
@@ -554,13 +556,13 @@ class Parser {
         auto curr = current();
         Expr* ex = NULL;
 
-        if (match({TokenType::BOOL_FALSE})) ex = new Literal(curr);
-        else if (match({TokenType::BOOL_TRUE})) ex = new Literal(curr);
-        else if (match({TokenType::NONE})) ex = new Literal(curr);
-        else if (match({TokenType::LITERAL_STRING, TokenType::LITERAL_INT})) ex = new Literal(curr);
+        if (match({TokenType::BOOL_FALSE})) ex = _arena.make<Literal>(curr);
+        else if (match({TokenType::BOOL_TRUE})) ex = _arena.make<Literal>(curr);
+        else if (match({TokenType::NONE})) ex = _arena.make<Literal>(curr);
+        else if (match({TokenType::LITERAL_STRING, TokenType::LITERAL_INT})) ex = _arena.make<Literal>(curr);
         else if (match({TokenType::IDENTIFIER})) {
             printf("ID\n");
-            ex = new Identifier(curr);
+            ex = _arena.make<Identifier>(curr);
         }
         // open tag
 
@@ -590,7 +592,7 @@ class Parser {
 
     // check type
     public:
-    Parser(std::vector<Token*>& v): _tokens(v), _currentPos(0), _endPos(v.size()) {};
+    Parser(std::vector<Token*>& v, Arena& arena): _tokens(v), _arena(arena), _currentPos(0), _endPos(v.size()) {};
 
     std::vector<Statement*> parse() {
         std::vector<Statement*> v;
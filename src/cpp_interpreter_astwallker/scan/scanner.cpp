@@ -1,9 +1,7 @@
 #include "scanner.h"
 #include "../tools/log.h"
-#include <sstream>
 #include <string>
 #include <map>
- #include <boost/filesystem.hpp>
 
 using namespace std;
 
@@ -27,15 +25,16 @@ map<std::string, TokenType> _keywords {
     {"eof", EOF_},
 };
 
+// reads the source in place, no copy.
 class ScanBuff {
 private:
   size_t _current;
   size_t _capacity;
-  string _buff;
+  const char* _buff;
 
 public:
-  ScanBuff(string &source)
-      : _current(0), _capacity(source.size()), _buff(source){};
+  ScanBuff(const char* source, size_t length)
+      : _current(0), _capacity(length), _buff(source){};
 
   size_t get_pos() { return _current; };
 
@@ -344,13 +343,19 @@ bool is_keyword(string& s) {
     else return false;
 };
 
-std::vector<Token*> Scanner::get_tokens(std::string &src) {
+std::vector<Token*> Scanner::get_tokens(const char* src, size_t length, Arena& arena) {
 
   vector<Token*> ls;
-  ScanBuff sb(src);
+  ScanBuff sb(src, length);
   string current;
-
   int line = 0;
+
+  // lexeme of `current` is in the source right before `end`.
+  auto token = [&](TokenType type, size_t end) {
+      const char* lex = src + end - current.size();
+      ls.push_back(arena.make<Token>(lex, (int)current.size(), type, nullptr, line));
+  };
+
   while(sb.can_read()) {
     // long->short
     
@@ -358,28 +363,28 @@ std::vector<Token*> Scanner::get_tokens(std::string &src) {
 
     // literals
     if (_literal_int(current, sb)) {
-        ls.push_back(new Token(current, LITERAL_INT, NULL, line));
+        token(LITERAL_INT, sb.get_pos());
         continue;
     }
     else if (_literal_string(current, sb)) {
-      ls.push_back(new Token(current, LITERAL_STRING, NULL, line));
+        // without quotes
+        token(LITERAL_STRING, sb.get_pos() - 1);
         continue;
     }
 
     if (_identifier(current, sb)) {
         if (is_keyword(current)) {
-            auto type = _keywords[current.c_str()];
-            ls.push_back(new Token(current,type, NULL, line));
+            token(_keywords[current.c_str()], sb.get_pos());
             continue;
         } else {
-            ls.push_back(new Token(current, IDENTIFIER, NULL, line));
+            token(IDENTIFIER, sb.get_pos());
             continue;
         } 
     }
 
     TokenType type;
     if (_single_or_two_chars_token(current, type, sb)) {
-        ls.push_back(new Token(current, type, NULL, line));
+        token(type, sb.get_pos());
         if (!sb.can_read()) break;
         continue;
     }
@@ -404,19 +409,3 @@ std::vector<Token*> Scanner::get_tokens(std::string &src) {
 
   return ls;
 };
-
-
-std::string Scanner::read_file(const char* path) {
-  stringstream ss;
-  string line;
-  if (boost::filesystem::exists(path)) {
-    boost::filesystem::ifstream fs(path);
-    if (fs.good()) {
-      while(getline(fs, line)) {
-        ss << line;
-      }
-    }
-  }
-
-  return ss.str();
-};
\ No newline at end of file
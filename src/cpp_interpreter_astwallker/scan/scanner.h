@@ -3,12 +3,13 @@
 #include <string>
 #include "token.h"
 #include <vector>
+#include "../tools/arena.h"
 
 class Scanner {
     private:
     int _pos;
     int _sourceLen;
     public:
-    std::vector<Token*> get_tokens(std::string& source);
-    std::string read_file(const char* path);
+    // tokens are allocated in `arena`, their lexemes point into `source`.
+    std::vector<Token*> get_tokens(const char* source, size_t length, Arena& arena);
 };
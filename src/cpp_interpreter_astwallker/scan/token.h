@@ -102,25 +102,31 @@ static std::map<TokenType, const char*> token_names {
     {EOF_, "eof"}
 };
 
+// lives in the unit's Arena, lexeme chars too.
 class Token {
     private:
-        std::string _lex;
+        const char* _lex;
+        int _length;
         TokenType _type;
         void* _literal;
         int _line;  
 
     public:
-        Token(std::string lex, TokenType type, void* literal, int line) 
-        : _lex(lex), _type(type), _literal(literal), _line(line){};
+        Token(const char* lex, int length, TokenType type, void* literal, int line) 
+        : _lex(lex), _length(length), _type(type), _literal(literal), _line(line){};
 
         std::string get_lex() {
-            return _lex;
+            return std::string(_lex, _length);
         };
 
         TokenType get_type() {
             return _type;
         };
 
+        int get_line() {
+            return _line;
+        };
+
         const char* get_name() {
             auto fn = token_names.find(_type);
             if (fn != end(token_names)) {
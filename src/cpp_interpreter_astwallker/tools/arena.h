@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator of one compilation unit: tokens, lexemes and AST nodes
+// are placed one after another in big blocks and released together with
+// the arena. Parser allocates in parse order, so a node lands right after
+// its children. Destructors run only for types that need them (vectors
+// in Block, Function), in reverse order of construction.
+class Arena {
+    private:
+    struct BlockHeader {
+        BlockHeader* prev;
+    };
+
+    struct Finalizer {
+        void (*destroy)(void*);
+        void* obj;
+        Finalizer* next;
+    };
+
+    BlockHeader* _block;
+    char* _top;
+    char* _end;
+    Finalizer* _finalizers;
+    size_t _used;
+    size_t _blocks;
+
+    void grow(size_t need) {
+        size_t size = BLOCK_SIZE;
+        while (size < need + sizeof(BlockHeader)) size *= 2;
+
+        BlockHeader* block = (BlockHeader*)malloc(size);
+        if (block == NULL) throw std::bad_alloc();
+        block->prev = _block;
+        _block = block;
+        _top = (char*)(block + 1);
+        _end = (char*)block + size;
+        _blocks++;
+    };
+
+    public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    Arena() : _block(NULL), _top(NULL), _end(NULL), _finalizers(NULL), _used(0), _blocks(0) {};
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (Finalizer* f = _finalizers; f != NULL; f = f->next) {
+            f->destroy(f->obj);
+        }
+
+        while (_block != NULL) {
+            BlockHeader* prev = _block->prev;
+            free(_block);
+            _block = prev;
+        }
+    };
+
+    void* alloc(size_t size, size_t align) {
+        uintptr_t ptr = ((uintptr_t)_top + align - 1) & ~(uintptr_t)(align - 1);
+        if (_top == NULL || ptr + size > (uintptr_t)_end) {
+            grow(size + align);
+            ptr = ((uintptr_t)_top + align - 1) & ~(uintptr_t)(align - 1);
+        }
+
+        _top = (char*)(ptr + size);
+        _used += size;
+        return (void*)ptr;
+    };
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* obj = new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            Finalizer* f = new (alloc(sizeof(Finalizer), alignof(Finalizer))) Finalizer();
+            f->destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+            f->obj = obj;
+            f->next = _finalizers;
+            _finalizers = f;
+        }
+
+        return obj;
+    };
+
+    // chars are not null terminated.
+    const char* copy(const std::string& s) {
+        char* chars = (char*)alloc(s.size(), 1);
+        memcpy(chars, s.data(), s.size());
+        return chars;
+    };
+
+    size_t used() const { return _used; };
+    size_t blocks() const { return _blocks; };
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Source file mapped read-only for the lifetime of the object. Scanner
+// reads it in place and tokens point into it, so it has to outlive the
+// tokens and the tree (declare it before the unit's Arena). Not null
+// terminated, use size().
+class MappedFile {
+    private:
+    const char* _data;
+    size_t _size;
+    bool _good;
+
+    public:
+    MappedFile(const char* path) : _data(""), _size(0), _good(false) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            _good = true;
+            // mmap of 0 bytes fails, an empty file is just "".
+            if (st.st_size > 0) {
+                void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    _data = (const char*)mapped;
+                    _size = (size_t)st.st_size;
+                    madvise(mapped, _size, MADV_SEQUENTIAL);
+                }
+                else _good = false;
+            }
+        }
+
+        close(fd);
+    };
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (_size > 0) munmap((void*)_data, _size);
+    };
+
+    const char* data() const { return _data; };
+    size_t size() const { return _size; };
+    bool good() const { return _good; };
+};